@@ -0,0 +1,322 @@
+// cover_control.c
+#include "cover_control.h"
+#include "endpoint_table.h"
+#include "wb_uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "ha/esp_zigbee_ha_standard.h"
+
+static const char *TAG = "COVER";
+
+// Текстовые команды адресуют эндпоинты, а не каналы. В Modbus реле переключаются
+// по опросу мастера, и пауза реверса на ESP32 ничего не гарантирует.
+#if !CONFIG_WB_PROTOCOL_BINARY && ENDPOINT_COVER_COUNT
+#error "window_covering endpoints need the binary protocol"
+#endif
+
+// Положение в сотых долях процента: 0 - открыто, COVER_POS_MAX - закрыто,
+// как CurrentPositionLiftPercentage в ZCL
+#define COVER_POS_MAX      10000
+#define COVER_POS_NONE     0xFFFF  // нет отложенной цели
+#define COVER_OFF_RETRY_MS 200     // повтор выключения, пока Wiren Board его не принял
+
+typedef enum {
+    COVER_IDLE,
+    COVER_UP,    // реле channel
+    COVER_DOWN,  // реле channel + 1
+} cover_dir_t;
+
+typedef struct {
+    uint8_t endpoint;
+    uint8_t channel;
+    uint8_t dir;        // cover_dir_t, какое реле сейчас включено
+    bool known;         // положение известно: после старта - только после хода до упора
+    bool stopping;      // выключение пары еще не принято Wiren Board
+    uint16_t pos;       // положение на момент start_us
+    uint16_t target;
+    uint16_t pending;   // цель после калибровочного хода вверх
+    int64_t start_us;   // включение мотора
+    int64_t stop_us;    // последнее выключение мотора
+} cover_t;
+
+static cover_t covers[ENDPOINT_COVER_COUNT ? ENDPOINT_COVER_COUNT : 1];
+static uint8_t cover_count;
+
+static cover_t *cover_find(uint8_t endpoint)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    if (route == NULL || !(route->clusters & EP_CLUSTER_WINDOW_COVERING)) {
+        return NULL;
+    }
+    for (int i = 0; i < cover_count; i++) {
+        if (covers[i].endpoint == endpoint) {
+            return &covers[i];
+        }
+    }
+    return NULL;
+}
+
+static inline uint32_t travel_ms(uint8_t dir)
+{
+    return dir == COVER_DOWN ? CONFIG_COVER_TRAVEL_DOWN_MS : CONFIG_COVER_TRAVEL_UP_MS;
+}
+
+// Положение с учетом идущего хода, упирается в крайние значения
+static uint16_t cover_position(const cover_t *c, int64_t now)
+{
+    if (c->dir == COVER_IDLE) {
+        return c->pos;
+    }
+    int64_t moved = (now - c->start_us) / 1000 * COVER_POS_MAX / travel_ms(c->dir);
+    if (c->dir == COVER_DOWN) {
+        return c->pos + moved >= COVER_POS_MAX ? COVER_POS_MAX : c->pos + moved;
+    }
+    return moved >= c->pos ? 0 : c->pos - moved;
+}
+
+// Оба реле пары: направление меняется одной пачкой, встречное реле - всегда 0
+static inline uint64_t cover_relays(const cover_t *c)
+{
+    return 3ULL << c->channel;
+}
+
+// Пока положение неизвестно, атрибут не трогаем: при создании он равен 0xFF
+// (значение не задано), а записать можно только 0..100
+static void cover_attr_update(const cover_t *c)
+{
+    if (!c->known) {
+        return;
+    }
+    uint8_t percent = (c->pos + 50) / 100;
+    esp_zb_zcl_status_t status =
+        esp_zb_zcl_set_attribute_val(c->endpoint, ESP_ZB_ZCL_CLUSTER_ID_WINDOW_COVERING,
+                                     ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                     ESP_ZB_ZCL_ATTR_WINDOW_COVERING_CURRENT_POSITION_LIFT_PERCENTAGE_ID,
+                                     &percent, false);
+    if (status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+        ESP_LOGW(TAG, "Endpoint %d: lift percentage %d not set, status 0x%x", c->endpoint, percent, status);
+    }
+}
+
+static void cover_start_alarm(uint8_t index);
+static void cover_stop_alarm(uint8_t index);
+static void cover_off_alarm(uint8_t index);
+
+// Выключение обоих реле пары. Очередь полна или кадр потерян после всех
+// повторов - выключение уходит снова, пока Wiren Board его не примет.
+static void cover_send_off(cover_t *c)
+{
+    if (wb_uart_send_relays(cover_relays(c), 0) != ESP_OK) {
+        ESP_LOGW(TAG, "Endpoint %d: motor off not queued", c->endpoint);
+    }
+    c->stopping = true;
+    esp_zb_scheduler_alarm_cancel(cover_off_alarm, c - covers);
+    esp_zb_scheduler_alarm(cover_off_alarm, c - covers, COVER_OFF_RETRY_MS);
+}
+
+static void cover_off_alarm(uint8_t index)
+{
+    cover_t *c = &covers[index];
+
+    if (c->dir != COVER_IDLE || wb_uart_relays_confirmed(cover_relays(c), 0)) {
+        c->stopping = false;
+        return;
+    }
+    ESP_LOGW(TAG, "Endpoint %d: motor off not confirmed, resending", c->endpoint);
+    cover_send_off(c);
+}
+
+static void cover_motor_off(cover_t *c)
+{
+    if (c->dir == COVER_IDLE) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    c->pos = cover_position(c, now);
+    cover_send_off(c);
+    c->dir = COVER_IDLE;
+    c->stop_us = now;
+}
+
+static void cover_alarms_cancel(cover_t *c)
+{
+    esp_zb_scheduler_alarm_cancel(cover_start_alarm, c - covers);
+    esp_zb_scheduler_alarm_cancel(cover_stop_alarm, c - covers);
+}
+
+// Время хода от pos к target. К краям - с запасом, чтобы дойти до упора
+// и заново привязать модель к механике.
+static uint32_t cover_run_ms(const cover_t *c, uint8_t dir)
+{
+    uint32_t full = travel_ms(dir);
+    uint32_t distance = c->target > c->pos ? c->target - c->pos : c->pos - c->target;
+    uint32_t ms = (uint64_t)distance * full / COVER_POS_MAX;
+    if (c->target == 0 || c->target == COVER_POS_MAX) {
+        ms += full * CONFIG_COVER_END_OVERRUN_PCT / 100;
+    }
+    return ms;
+}
+
+// Включение мотора к c->target. Только из простоя: встречное реле уже
+// выключено, а с его выключения прошло не меньше паузы реверса.
+// Выключение должно быть принято Wiren Board (с подтверждениями - по ACK);
+// иначе запуск ждет еще одну паузу реверса, а выключение повторяется.
+static void cover_start(cover_t *c)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t wait_us = c->stop_us + CONFIG_COVER_REVERSE_DELAY_MS * 1000LL - now;
+
+    if (c->dir != COVER_IDLE) {
+        return;
+    }
+    if (wait_us > 0) {
+        esp_zb_scheduler_alarm(cover_start_alarm, c - covers, (wait_us + 999) / 1000);
+        return;
+    }
+    if (!wb_uart_relays_confirmed(cover_relays(c), 0)) {
+        ESP_LOGI(TAG, "Endpoint %d: waiting for relays %d/%d to be confirmed off",
+                 c->endpoint, c->channel, c->channel + 1);
+        if (!c->stopping) {
+            cover_send_off(c);
+        }
+        c->stop_us = now;
+        esp_zb_scheduler_alarm(cover_start_alarm, c - covers, CONFIG_COVER_REVERSE_DELAY_MS);
+        return;
+    }
+
+    uint8_t dir;
+    if (!c->known) {
+        // Точки отсчета нет (цель всегда край): считаем, что идем от противоположного упора
+        dir = c->target == 0 ? COVER_UP : COVER_DOWN;
+        c->pos = dir == COVER_UP ? COVER_POS_MAX : 0;
+    } else if (c->target == c->pos) {
+        // В крайнем положении ход к тому же краю повторяется с запасом
+        if (c->target != 0 && c->target != COVER_POS_MAX) {
+            return;
+        }
+        dir = c->target ? COVER_DOWN : COVER_UP;
+    } else {
+        dir = c->target > c->pos ? COVER_DOWN : COVER_UP;
+    }
+    uint32_t run_ms = cover_run_ms(c, dir);
+    uint64_t on = 1ULL << (dir == COVER_UP ? c->channel : c->channel + 1);
+
+    if (wb_uart_send_relays(cover_relays(c), on) != ESP_OK) {
+        ESP_LOGW(TAG, "Endpoint %d: motor start not queued", c->endpoint);
+        return;
+    }
+    // Выключение принято - его повтор больше не нужен
+    esp_zb_scheduler_alarm_cancel(cover_off_alarm, c - covers);
+    c->stopping = false;
+    c->dir = dir;
+    c->start_us = now;
+    esp_zb_scheduler_alarm(cover_stop_alarm, c - covers, run_ms ? run_ms : 1);
+}
+
+static void cover_start_alarm(uint8_t index)
+{
+    cover_start(&covers[index]);
+}
+
+// Мотор дошел до цели по расчету
+static void cover_stop_alarm(uint8_t index)
+{
+    cover_t *c = &covers[index];
+
+    cover_motor_off(c);
+    c->pos = c->target;
+    c->known = true;
+    cover_attr_update(c);
+    if (c->pending != COVER_POS_NONE) {
+        c->target = c->pending;
+        c->pending = COVER_POS_NONE;
+        cover_start(c);
+    }
+}
+
+static void cover_move_to(cover_t *c, uint16_t target)
+{
+    int64_t now = esp_timer_get_time();
+
+    cover_alarms_cancel(c);
+    c->pending = COVER_POS_NONE;
+    if (!c->known && target != 0 && target != COVER_POS_MAX) {
+        // Промежуточное положение без точки отсчета: сначала до верхнего упора
+        c->pending = target;
+        target = 0;
+    }
+
+    if (c->dir != COVER_IDLE) {
+        uint16_t pos = cover_position(c, now);
+        bool same_dir = c->dir == COVER_DOWN ? target > pos || target == COVER_POS_MAX
+                                             : target < pos || target == 0;
+        if (same_dir) {
+            // Продолжаем ход без выключения реле, меняется только время остановки
+            c->pos = pos;
+            c->start_us = now;
+            c->target = target;
+            uint32_t run_ms = cover_run_ms(c, c->dir);
+            esp_zb_scheduler_alarm(cover_stop_alarm, c - covers, run_ms ? run_ms : 1);
+            return;
+        }
+        cover_motor_off(c);
+    }
+    c->target = target;
+    cover_start(c);
+}
+
+static void cover_stop(cover_t *c)
+{
+    cover_alarms_cancel(c);
+    c->pending = COVER_POS_NONE;
+    cover_motor_off(c);
+    c->target = c->pos;
+    cover_attr_update(c);
+}
+
+esp_err_t cover_control_init(void)
+{
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        if (!(ep->clusters & EP_CLUSTER_WINDOW_COVERING)) {
+            continue;
+        }
+        covers[cover_count++] = (cover_t){
+            .endpoint = ep->endpoint,
+            .channel = ep->channel,
+            .pending = COVER_POS_NONE,
+            .stop_us = esp_timer_get_time(),
+        };
+        ESP_LOGI(TAG, "Cover endpoint %d on relays %d (up) / %d (down)", ep->endpoint, ep->channel, ep->channel + 1);
+    }
+    return ESP_OK;
+}
+
+bool cover_control_handle_command(uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len)
+{
+    cover_t *c = cover_find(endpoint);
+    if (c == NULL) {
+        return false;
+    }
+
+    switch (cmd_id) {
+    case ESP_ZB_ZCL_CMD_WINDOW_COVERING_UP_OPEN:
+        cover_move_to(c, 0);
+        return true;
+    case ESP_ZB_ZCL_CMD_WINDOW_COVERING_DOWN_CLOSE:
+        cover_move_to(c, COVER_POS_MAX);
+        return true;
+    case ESP_ZB_ZCL_CMD_WINDOW_COVERING_STOP:
+        cover_stop(c);
+        return true;
+    case ESP_ZB_ZCL_CMD_WINDOW_COVERING_GO_TO_LIFT_PERCENTAGE:
+        if (len < 1 || payload[0] > 100) {
+            return false;
+        }
+        cover_move_to(c, payload[0] * 100);
+        return true;
+    default:
+        return false;
+    }
+}
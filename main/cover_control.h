@@ -0,0 +1,19 @@
+// cover_control.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Шторы - эндпоинты с кластером window_covering из endpoints.csv: пара реле
+// Wiren Board, channel - вверх, channel + 1 - вниз. Датчика положения нет,
+// положение считается по времени работы мотора и калиброванному времени
+// полного хода (menuconfig -> "Window covering"). Оба реле пары никогда не
+// включены одновременно, между сменами направления выдерживается пауза.
+// Все функции вызываются из задачи Zigbee.
+esp_err_t cover_control_init(void);
+
+// Команда кластера Window Covering из стека. false - команда не разобрана,
+// ее обработает стек.
+bool cover_control_handle_command(uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len);
@@ -0,0 +1,62 @@
+// endpoint_table.c
+#include "endpoint_table.h"
+#include "esp_attr.h"
+#include "ha/esp_zigbee_ha_standard.h"
+
+// Типы устройств из столбца device
+#define EP_DEVICE_ON_OFF_LIGHT   ESP_ZB_HA_ON_OFF_LIGHT_DEVICE_ID
+#define EP_DEVICE_ON_OFF_OUTPUT  ESP_ZB_HA_ON_OFF_OUTPUT_DEVICE_ID
+#define EP_DEVICE_DIMMABLE_LIGHT ESP_ZB_HA_DIMMABLE_LIGHT_DEVICE_ID
+#define EP_DEVICE_WINDOW_COVERING ESP_ZB_HA_WINDOW_COVERING_DEVICE_ID
+
+#define EP_ROW(ep, dev, cl, ch, tr, io) \
+    { .endpoint = (ep), .clusters = (cl), .channel = (ch), .transport = (tr), .gpio = (io), .device_id = (dev) },
+
+const endpoint_desc_t endpoint_table[ENDPOINT_TABLE_COUNT] = {
+    ENDPOINT_TABLE_ROWS(EP_ROW)
+};
+
+// Обратное отображение канал -> эндпоинт, только для строк с каналом Wiren Board
+#define UART_ENTRY(ep, dev, cl, ch, tr, io)  UART_ENTRY_##tr(ep, ch)
+#define UART_ENTRY_EP_TRANSPORT_UART(ep, ch)  [(ch)] = (ep),
+#define UART_ENTRY_EP_TRANSPORT_BOTH(ep, ch)  [(ch)] = (ep),
+#define UART_ENTRY_EP_TRANSPORT_FALLBACK(ep, ch)  [(ch)] = (ep),
+#define UART_ENTRY_EP_TRANSPORT_GPIO(ep, ch)
+
+#if ENDPOINT_UART_CHANNELS
+static const uint8_t uart_channel_endpoint[ENDPOINT_UART_CHANNELS] = {
+    ENDPOINT_TABLE_ROWS(UART_ENTRY)
+};
+#endif
+
+// Читается на каждую команду из Zigbee - держим в DRAM, а не во flash
+DRAM_ATTR endpoint_route_t endpoint_routes[ENDPOINT_ID_MAX + 1];
+
+void endpoint_table_init(void)
+{
+    for (size_t i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        endpoint_routes[ep->endpoint] = (endpoint_route_t){
+            .transport = ep->transport,
+            .channel = ep->channel,
+            .clusters = ep->clusters,
+            .index = i,
+        };
+    }
+}
+
+const endpoint_desc_t *endpoint_table_find(uint8_t endpoint)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    return route ? &endpoint_table[route->index] : NULL;
+}
+
+uint8_t endpoint_table_uart_endpoint(uint8_t channel)
+{
+#if ENDPOINT_UART_CHANNELS
+    if (channel < ENDPOINT_UART_CHANNELS) {
+        return uart_channel_endpoint[channel];
+    }
+#endif
+    return 0;
+}
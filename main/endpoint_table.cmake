@@ -0,0 +1,173 @@
+# Генерация endpoint_table_gen.h из CSV-таблицы эндпоинтов.
+# Разбор выполняется один раз при конфигурации, в прошивку попадают только константы.
+function(endpoint_table_generate csv_file out_file)
+    file(STRINGS "${csv_file}" lines ENCODING UTF-8)
+
+    set(rows "")
+    set(count 0)
+    set(uart_channels 0)
+    set(gpio_count 0)
+    set(level_count 0)
+    set(pwm_count 0)
+    set(cover_count 0)
+    set(endpoints "")
+    set(channels "")
+    set(pins "")
+    set(header_seen FALSE)
+    # Число выводов чипа из sdkconfig; без него (разбор вне сборки IDF) - как у ESP32-C6
+    if(DEFINED CONFIG_SOC_GPIO_PIN_COUNT)
+        set(gpio_pin_count ${CONFIG_SOC_GPIO_PIN_COUNT})
+    else()
+        set(gpio_pin_count 31)
+    endif()
+    math(EXPR gpio_max "${gpio_pin_count} - 1")
+
+    foreach(line IN LISTS lines)
+        string(STRIP "${line}" line)
+        if(line STREQUAL "" OR line MATCHES "^#")
+            continue()
+        endif()
+        # Первая строка - заголовок столбцов
+        if(NOT header_seen)
+            set(header_seen TRUE)
+            continue()
+        endif()
+
+        string(REPLACE "," ";" fields "${line}")
+        list(LENGTH fields nfields)
+        if(NOT nfields EQUAL 6)
+            message(FATAL_ERROR "${csv_file}: expected 6 columns: ${line}")
+        endif()
+        list(GET fields 0 endpoint)
+        list(GET fields 1 device)
+        list(GET fields 2 clusters)
+        list(GET fields 3 channel)
+        list(GET fields 4 transport)
+        list(GET fields 5 gpio)
+        foreach(var endpoint device clusters channel transport gpio)
+            string(STRIP "${${var}}" ${var})
+        endforeach()
+
+        if(NOT endpoint MATCHES "^[0-9]+$" OR endpoint LESS 1 OR endpoint GREATER 240)
+            message(FATAL_ERROR "${csv_file}: endpoint must be 1..240: ${line}")
+        endif()
+        if(endpoint IN_LIST endpoints)
+            message(FATAL_ERROR "${csv_file}: duplicate endpoint ${endpoint}")
+        endif()
+        list(APPEND endpoints ${endpoint})
+
+        if(NOT channel MATCHES "^[0-9]+$")
+            message(FATAL_ERROR "${csv_file}: channel must be a number: ${line}")
+        endif()
+        string(TOUPPER "${transport}" transport)
+        # Локальный выход: для gpio это сам channel, для both/fallback - столбец gpio
+        if(transport STREQUAL "GPIO")
+            if(NOT gpio STREQUAL "-")
+                message(FATAL_ERROR "${csv_file}: gpio transport takes the pin from channel, gpio must be '-': ${line}")
+            endif()
+            set(gpio ${channel})
+        elseif(transport STREQUAL "BOTH" OR transport STREQUAL "FALLBACK")
+            if(NOT gpio MATCHES "^[0-9]+$")
+                message(FATAL_ERROR "${csv_file}: both/fallback transport needs a gpio pin: ${line}")
+            endif()
+        elseif(NOT gpio STREQUAL "-")
+            message(FATAL_ERROR "${csv_file}: gpio must be '-' for uart transport: ${line}")
+        endif()
+        if(gpio STREQUAL "-")
+            set(gpio "EP_GPIO_NONE")
+        else()
+            if(gpio GREATER gpio_max)
+                message(FATAL_ERROR "${csv_file}: GPIO must be 0..${gpio_max}: ${line}")
+            endif()
+            if(gpio IN_LIST pins)
+                message(FATAL_ERROR "${csv_file}: duplicate GPIO ${gpio}")
+            endif()
+            list(APPEND pins ${gpio})
+        endif()
+
+        string(TOUPPER "${clusters}" clusters)
+        string(REPLACE "|" ";" cluster_list "${clusters}")
+
+        if(transport STREQUAL "UART" OR transport STREQUAL "BOTH" OR transport STREQUAL "FALLBACK")
+            # Шторе нужна пара реле: channel - вверх, channel + 1 - вниз
+            set(last_channel ${channel})
+            if("WINDOW_COVERING" IN_LIST cluster_list)
+                math(EXPR last_channel "${channel} + 1")
+            endif()
+            if(last_channel GREATER 63)
+                message(FATAL_ERROR "${csv_file}: UART channel must be 0..63: ${line}")
+            endif()
+            foreach(ch RANGE ${channel} ${last_channel})
+                if(ch IN_LIST channels)
+                    message(FATAL_ERROR "${csv_file}: duplicate UART channel ${ch}")
+                endif()
+                list(APPEND channels ${ch})
+            endforeach()
+            if(NOT last_channel LESS uart_channels)
+                math(EXPR uart_channels "${last_channel} + 1")
+            endif()
+        elseif(NOT transport STREQUAL "GPIO")
+            message(FATAL_ERROR "${csv_file}: transport must be uart, gpio, both or fallback: ${line}")
+        endif()
+
+        string(TOUPPER "${device}" device)
+        # Basic описывает устройство целиком - только на первом эндпоинте,
+        # на остальных это лишняя копия атрибутов в куче
+        if(count GREATER 0 AND "BASIC" IN_LIST cluster_list)
+            message(FATAL_ERROR "${csv_file}: basic cluster belongs to the first endpoint only: ${line}")
+        endif()
+        set(cluster_expr "")
+        foreach(cluster IN LISTS cluster_list)
+            string(STRIP "${cluster}" cluster)
+            if(cluster_expr STREQUAL "")
+                set(cluster_expr "EP_CLUSTER_${cluster}")
+            else()
+                set(cluster_expr "${cluster_expr} | EP_CLUSTER_${cluster}")
+            endif()
+        endforeach()
+
+        if("WINDOW_COVERING" IN_LIST cluster_list)
+            # Реле штор переключает только модель положения, с блокировкой встречного
+            if(NOT transport STREQUAL "UART" OR "ON_OFF" IN_LIST cluster_list OR "LEVEL" IN_LIST cluster_list)
+                message(FATAL_ERROR "${csv_file}: window_covering needs uart transport and no on_off or level cluster: ${line}")
+            endif()
+            math(EXPR cover_count "${cover_count} + 1")
+        elseif("LEVEL" IN_LIST cluster_list)
+            # Диммер: выход gpio - канал LEDC, а не бит набора выделенных GPIO
+            if(NOT transport STREQUAL "UART" AND NOT transport STREQUAL "GPIO")
+                message(FATAL_ERROR "${csv_file}: level endpoints support uart or gpio transport only: ${line}")
+            endif()
+            math(EXPR level_count "${level_count} + 1")
+            if(transport STREQUAL "GPIO")
+                math(EXPR pwm_count "${pwm_count} + 1")
+            endif()
+        elseif(NOT gpio STREQUAL "EP_GPIO_NONE")
+            math(EXPR gpio_count "${gpio_count} + 1")
+        endif()
+
+        string(APPEND rows "    X(${endpoint}, EP_DEVICE_${device}, ${cluster_expr}, ${channel}, EP_TRANSPORT_${transport}, ${gpio}) \\\n")
+        math(EXPR count "${count} + 1")
+    endforeach()
+
+    if(count EQUAL 0)
+        message(FATAL_ERROR "${csv_file}: no endpoints")
+    endif()
+
+    get_filename_component(csv_name "${csv_file}" NAME)
+    message(STATUS "Endpoint table ${csv_name}: ${count} endpoints, ${uart_channels} UART channels, ${gpio_count} GPIO outputs, ${level_count} dimmers, ${cover_count} covers")
+    set(content "// Сгенерировано из ${csv_name}, не редактировать\n")
+    string(APPEND content "#pragma once\n\n")
+    string(APPEND content "#define ENDPOINT_TABLE_COUNT    ${count}\n")
+    string(APPEND content "#define ENDPOINT_UART_CHANNELS  ${uart_channels}\n")
+    string(APPEND content "#define ENDPOINT_GPIO_COUNT     ${gpio_count}\n")
+    string(APPEND content "#define ENDPOINT_LEVEL_COUNT    ${level_count}\n")
+    string(APPEND content "#define ENDPOINT_PWM_COUNT      ${pwm_count}\n")
+    string(APPEND content "#define ENDPOINT_COVER_COUNT    ${cover_count}\n\n")
+    string(APPEND content "// X(endpoint, device, clusters, channel, transport, gpio)\n")
+    string(APPEND content "#define ENDPOINT_TABLE_ROWS(X) \\\n${rows}\n")
+
+    # Перезаписываем только при изменениях, чтобы не пересобирать зависимые файлы
+    file(WRITE "${out_file}.tmp" "${content}")
+    configure_file("${out_file}.tmp" "${out_file}" COPYONLY)
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${csv_file}")
+endfunction()
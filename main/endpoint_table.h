@@ -0,0 +1,76 @@
+// endpoint_table.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_bit_defs.h"
+#include "endpoint_table_gen.h"
+
+// Кластеры сервера эндпоинта (столбец clusters в CSV)
+#define EP_CLUSTER_BASIC   BIT0
+#define EP_CLUSTER_ON_OFF  BIT1
+#define EP_CLUSTER_LEVEL   BIT2
+#define EP_CLUSTER_WINDOW_COVERING  BIT3  // пара реле: channel - вверх, channel + 1 - вниз
+
+// Наибольший номер эндпоинта приложения в Zigbee
+#define ENDPOINT_ID_MAX  240
+
+// Нет локального выхода (столбец gpio = '-')
+#define EP_GPIO_NONE     0xFF
+
+typedef enum {
+    EP_TRANSPORT_NONE,  // эндпоинта нет в таблице
+    EP_TRANSPORT_UART,  // реле Wiren Board, channel - номер канала
+    EP_TRANSPORT_GPIO,  // выход ESP32, channel - номер GPIO
+    EP_TRANSPORT_BOTH,  // канал channel и выход gpio одновременно
+    EP_TRANSPORT_FALLBACK,  // канал channel, при потере связи с Wiren Board - выход gpio
+} endpoint_transport_t;
+
+// Команды эндпоинта уходят в Wiren Board
+static inline bool endpoint_transport_has_uart(uint8_t transport)
+{
+    return transport == EP_TRANSPORT_UART || transport == EP_TRANSPORT_BOTH ||
+           transport == EP_TRANSPORT_FALLBACK;
+}
+
+typedef struct {
+    uint8_t endpoint;
+    uint8_t clusters;   // EP_CLUSTER_*
+    uint8_t channel;
+    uint8_t transport;  // endpoint_transport_t
+    uint8_t gpio;       // локальный выход или EP_GPIO_NONE
+    uint16_t device_id; // ESP_ZB_HA_*_DEVICE_ID
+} endpoint_desc_t;
+
+// Маршрут команды для эндпоинта: все, что нужно при обработке атрибута
+typedef struct {
+    uint8_t transport;  // endpoint_transport_t, EP_TRANSPORT_NONE - нет эндпоинта
+    uint8_t channel;
+    uint8_t clusters;
+    uint8_t index;      // строка в endpoint_table
+} endpoint_route_t;
+
+// Строки таблицы в порядке CSV
+extern const endpoint_desc_t endpoint_table[ENDPOINT_TABLE_COUNT];
+
+// Плотная таблица маршрутов по номеру эндпоинта, в DRAM
+extern endpoint_route_t endpoint_routes[ENDPOINT_ID_MAX + 1];
+
+// Заполнение endpoint_routes, один раз перед регистрацией эндпоинтов
+void endpoint_table_init(void);
+
+// Маршрут эндпоинта за O(1) или NULL, если его нет в таблице
+static inline const endpoint_route_t *endpoint_table_route(uint8_t endpoint)
+{
+    if (endpoint > ENDPOINT_ID_MAX || endpoint_routes[endpoint].transport == EP_TRANSPORT_NONE) {
+        return NULL;
+    }
+    return &endpoint_routes[endpoint];
+}
+
+// Описание эндпоинта или NULL, если его нет в таблице
+const endpoint_desc_t *endpoint_table_find(uint8_t endpoint);
+
+// Эндпоинт, назначенный каналу реле Wiren Board, или 0
+uint8_t endpoint_table_uart_endpoint(uint8_t channel);
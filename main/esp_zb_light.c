@@ -1,147 +1,46 @@
-#include "driver/gpio.h"
-#include "driver/uart.h"
 #include "esp_zb_light.h"
+#include "cover_control.h"
+#include "endpoint_table.h"
+#include "group_control.h"
+#include "level_control.h"
+#include "relay_output.h"
+#include "relay_report.h"
+#include "relay_state.h"
+#include "scene_control.h"
+#include "wb_uart.h"
+#include "zb_rx_mode.h"
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "ha/esp_zigbee_ha_standard.h"
+#include "zboss_api.h"
 #include "string.h"
 
-#if !defined ZB_ED_ROLE
-#error Define ZB_ED_ROLE in idf.py menuconfig to compile light (End Device) source code.
+#if !defined ZB_ED_ROLE && !defined ZB_ROUTER_ROLE
+#error Select End Device or Coordinator/Router as the Zigbee device type in idf.py menuconfig.
 #endif
 
 static const char *TAG = "ESP_ZB_USB_UART";
 #define ESP_MANUFACTURER_NAME "ESP_CUSTOM"
 #define ESP_MODEL_IDENTIFIER "ESP_LIGHT"
-
-// UART конфигурации для передачи через реальные выводы
-#define UART_PORT_NUM      UART_NUM_0
-#define UART_BAUD_RATE     115200
-#define UART_BUF_SIZE      256
-#define UART_QUEUE_SIZE    20
-#define UART_TX_PIN        GPIO_NUM_16  // Выберите подходящие GPIO для вашей платы
-#define UART_RX_PIN        GPIO_NUM_17  // Выберите подходящие GPIO для вашей платы
-
-// Protocol definition
-#define CMD_PREFIX        "CMD:"
-#define CMD_ON_TEMPLATE   "CMD:EP%d:ON"
-#define CMD_OFF_TEMPLATE  "CMD:EP%d:OFF"
-#define CMD_END           "\r\n"
-
-// Global variables
-static QueueHandle_t uart_queue;
+// Способ доставки в кадре APS (биты 2-3 frame control): 3 - на группу
+#define APS_FC_DELIVERY_MODE(fc)  (((fc) >> 2) & 0x03)
+#define APS_DELIVERY_GROUP        3
+// Куча, которую оценка числа эндпоинтов оставляет стеку и задачам
+#define ENDPOINT_HEAP_RESERVE  (32 * 1024)
 
 // Заранее объявляю функции
-static esp_err_t uart_driver_init(void);
-static void send_command_to_wirenboard(uint8_t endpoint, bool state);
-static void uart_event_task(void *pvParameters);
 static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask);
 static esp_err_t zb_attribute_handler(const esp_zb_zcl_set_attr_value_message_t *message);
 static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id, const void *message);
+static void wb_state_report_handler(uint64_t mask, uint64_t values);
+static bool zb_raw_command_handler(uint8_t bufid);
 static void esp_zb_task(void *pvParameters);
 
-// UART инициализация с реальными выводами
-static esp_err_t uart_driver_init(void)
-{
-    uart_config_t uart_config = {
-        .baud_rate = UART_BAUD_RATE,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-        .source_clk = UART_SCLK_DEFAULT,
-    };
-    
-    // Install UART driver with event queue
-    esp_err_t ret = uart_driver_install(UART_PORT_NUM, 
-                                      UART_BUF_SIZE * 2,
-                                      UART_BUF_SIZE * 2,
-                                      UART_QUEUE_SIZE,
-                                      &uart_queue,
-                                      0);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "UART driver install failed");
-        return ret;
-    }
-    
-    ret = uart_param_config(UART_PORT_NUM, &uart_config);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "UART param config failed");
-        return ret;
-    }
-    
-    // Устанавливаем пины для реального UART
-    ret = uart_set_pin(UART_PORT_NUM, UART_TX_PIN, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "UART pin config failed");
-        return ret;
-    }
-    
-    ESP_LOGI(TAG, "UART initialized with TX=%d, RX=%d", UART_TX_PIN, UART_RX_PIN);
-    return ESP_OK;
-}
-
-
-
-// UART обработчик событий
-static void uart_event_task(void *pvParameters)
-{
-    uart_event_t event;
-    uint8_t rx_buf[UART_BUF_SIZE];
-    
-    for (;;) {
-        if (xQueueReceive(uart_queue, (void *)&event, portMAX_DELAY)) {
-            switch (event.type) {
-                case UART_DATA:
-                    // Считываем с юарта
-                    int len = uart_read_bytes(UART_PORT_NUM, rx_buf, event.size, portMAX_DELAY);
-                    if (len > 0) {
-                        rx_buf[len] = '\0'; 
-                        //ESP_LOGI(TAG, "Received from Wirenboard: %s", rx_buf);
-                    }
-                    break;
-                    
-                case UART_FIFO_OVF:
-                case UART_BUFFER_FULL:
-                    ESP_LOGW(TAG, "UART buffer overflow");
-                    uart_flush_input(UART_PORT_NUM);
-                    break;
-                    
-                default:
-                    break;
-            }
-        }
-    }
-    vTaskDelete(NULL);
-}
-
-
-static void send_command_to_wirenboard(uint8_t endpoint, bool state)
-{
-    char command[32];
-    
-    if (state) {
-        snprintf(command, sizeof(command), CMD_ON_TEMPLATE, endpoint);
-    } else {
-        snprintf(command, sizeof(command), CMD_OFF_TEMPLATE, endpoint);
-    }
-    
-    strcat(command, CMD_END);
-    
-    int len = strlen(command);
-    int sent = uart_write_bytes(UART_PORT_NUM, command, len);
-    
-    // if (sent == len) {
-    //     ESP_LOGI(TAG, "Sent command to Wirenboard: %s", command);
-    // } else {
-    //     ESP_LOGE(TAG, "Failed to send command to Wirenboard, sent %d/%d bytes", sent, len);
-    // }
-}
-
 // Callback для запуска комиссинга
 static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask)
 {
@@ -163,7 +62,6 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
     case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
     case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
         if (err_status == ESP_OK) {
-            ESP_LOGI(TAG, "Deferred driver init: %s", uart_driver_init() ? "failed" : "success");
             ESP_LOGI(TAG, "Device started up in %s factory-reset mode", 
                    esp_zb_bdb_is_factory_new() ? "" : "non");
             if (esp_zb_bdb_is_factory_new()) {
@@ -171,6 +69,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
                 esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
             } else {
                 ESP_LOGI(TAG, "Device rebooted");
+                zb_rx_mode_joined();
             }
         } else {
             ESP_LOGI(TAG, "Start network steering failed, status: %s, retry after 1s", 
@@ -187,6 +86,7 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
                    extended_pan_id[7], extended_pan_id[6], extended_pan_id[5], extended_pan_id[4],
                    extended_pan_id[3], extended_pan_id[2], extended_pan_id[1], extended_pan_id[0],
                    esp_zb_get_pan_id(), esp_zb_get_current_channel(), esp_zb_get_short_address());
+            zb_rx_mode_joined();
         } else {
             ESP_LOGI(TAG, "Network steering failed, status: %s, retry after 1s", 
                    esp_err_to_name(err_status));
@@ -194,6 +94,13 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
                                  ESP_ZB_BDB_MODE_NETWORK_STEERING, 1000);
         }
         break;
+    case ESP_ZB_ZDO_SIGNAL_LEAVE:
+        // Таблица групп APS очищается вместе с выходом из сети
+        group_control_clear();
+        scene_control_clear();
+        zb_rx_mode_left();
+        ESP_LOGI(TAG, "Left the network");
+        break;
     default:
         ESP_LOGI(TAG, "ZDO signal: %s (0x%x), status: %s", 
                esp_zb_zdo_signal_to_string(sig_type), sig_type,
@@ -205,91 +112,249 @@ void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
 // Обработчик атрибутов Zigbee
 static esp_err_t zb_attribute_handler(const esp_zb_zcl_set_attr_value_message_t *message)
 {
-    
-    if ((message->info.dst_endpoint >= HA_ESP_LIGHT_ENDPOINT && 
-         message->info.dst_endpoint <= HA_ESP_LIGHT_ENDPOINT + 1) &&
-        message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF &&
+    const endpoint_route_t *route = endpoint_table_route(message->info.dst_endpoint);
+
+    if (route && message->info.cluster == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF &&
         message->attribute.id == ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID) {
         bool state = *(bool *)message->attribute.data.value;
-        send_command_to_wirenboard(message->info.dst_endpoint, state);
+        relay_output_set(message->info.dst_endpoint, state);
     }
     return ESP_OK;
 }
 
+// Состояние реле, измененное на стороне Wiren Board (выключатели, правила).
+// Атрибуты изменившихся эндпоинтов обновит relay_report в задаче Zigbee.
+static void wb_state_report_handler(uint64_t mask, uint64_t values)
+{
+    relay_bits_snapshot_t ep_mask = {0};
+    relay_bits_snapshot_t ep_values = {0};
+    relay_bits_snapshot_t current;
+    relay_bits_snapshot_t changed;
+
+#if ENDPOINT_UART_CHANNELS < 64
+    mask &= (1ULL << ENDPOINT_UART_CHANNELS) - 1;
+#endif
+    // Каналы -> биты эндпоинтов
+    while (mask) {
+        uint8_t channel = __builtin_ctzll(mask);
+        uint8_t endpoint = endpoint_table_uart_endpoint(channel);
+        const endpoint_route_t *route = endpoint_table_route(endpoint);
+        // Реле штор ведет только модель положения, их отчеты не отражаются
+        if (route && !(route->clusters & EP_CLUSTER_WINDOW_COVERING)) {
+            ep_mask.w[endpoint / 32] |= 1UL << (endpoint % 32);
+            if ((values >> channel) & 1) {
+                ep_values.w[endpoint / 32] |= 1UL << (endpoint % 32);
+            }
+        }
+        mask &= mask - 1;
+    }
+
+    // Отчет только об эндпоинтах, чье состояние действительно изменилось
+    relay_bits_snapshot(&relay_state, &current);
+    relay_bits_diff(&current, &ep_values, &changed);
+    relay_bits_apply(&relay_state, &ep_mask, &ep_values);
+    // Эндпоинты both повторяют реле Wiren Board на своем GPIO
+    relay_output_mirror(&ep_mask, &ep_values);
+
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        changed.w[i] &= ep_mask.w[i];
+    }
+    relay_report_mark(&changed);
+}
+
+// Сколько кучи стоят эндпоинты и сколько их еще поместится. Первый эндпоинт
+// несет Basic, поэтому его стоимость считается отдельно от остальных.
+// Считается при запуске: кучу под кластеры выделяет стек, при сборке она неизвестна.
+static void endpoint_heap_report(size_t primary, size_t secondary_total, size_t registration)
+{
+    size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t spare = free_heap > ENDPOINT_HEAP_RESERVE ? free_heap - ENDPOINT_HEAP_RESERVE : 0;
+    size_t per_ep = registration / ENDPOINT_TABLE_COUNT;
+    if (ENDPOINT_TABLE_COUNT > 1) {
+        per_ep += secondary_total / (ENDPOINT_TABLE_COUNT - 1);
+    } else {
+        per_ep += primary;  // других эндпоинтов нет - оцениваем по первому
+    }
+    size_t max_eps = ENDPOINT_TABLE_COUNT + (per_ep ? spare / per_ep : 0);
+    if (max_eps > ENDPOINT_ID_MAX) {
+        max_eps = ENDPOINT_ID_MAX;
+    }
+
+    ESP_LOGI(TAG, "Endpoints: %d, heap: primary %u B, each next ~%u B, free %u B",
+             ENDPOINT_TABLE_COUNT, (unsigned)primary, (unsigned)per_ep, (unsigned)free_heap);
+    ESP_LOGI(TAG, "Heap fits up to %u endpoints (keeping %u B reserve)",
+             (unsigned)max_eps, (unsigned)ENDPOINT_HEAP_RESERVE);
+}
+
 // Обработчик действий Zigbee
 static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id, const void *message)
 {
     switch (callback_id) {
     case ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID:
         return zb_attribute_handler((esp_zb_zcl_set_attr_value_message_t *)message);
+    case ESP_ZB_CORE_SCENES_STORE_SCENE_CB_ID: {
+        const esp_zb_zcl_store_scene_message_t *store = message;
+        scene_control_store(store->info.dst_endpoint, store->group_id, store->scene_id);
+        return ESP_OK;
+    }
+    case ESP_ZB_CORE_SCENES_RECALL_SCENE_CB_ID: {
+        const esp_zb_zcl_recall_scene_message_t *recall = message;
+        scene_control_recall_fields(recall->info.dst_endpoint, recall->field_set, recall->transition_time);
+        return ESP_OK;
+    }
     default:
        // ESP_LOGW(TAG, "Unhandled Zigbee action callback: 0x%x", callback_id);
         return ESP_OK;
     }
 }
 
+// Команды Level Control и Window Covering разбираем сами: переход диммера и
+// ход шторы считаются по времени на месте, без пошаговых обновлений в стеке.
+// On/Off и Recall Scene на группу выполняются сразу для всех ее эндпоинтов.
+static bool zb_raw_command_handler(uint8_t bufid)
+{
+    zb_zcl_parsed_hdr_t *cmd_info = ZB_BUF_GET_PARAM(bufid, zb_zcl_parsed_hdr_t);
+    const uint8_t aps_fc = ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).fc;
+
+    // Любой кадр от хаба продлевает частый опрос (в режиме sleepy)
+    zb_rx_mode_activity();
+    if (cmd_info->is_common_command || cmd_info->cmd_direction != ZB_ZCL_FRAME_DIRECTION_TO_SRV) {
+        return false;
+    }
+    uint8_t endpoint = ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).dst_endpoint;
+    const uint8_t *payload = zb_buf_begin(bufid);
+    size_t len = zb_buf_len(bufid);
+    uint8_t status = ZB_ZCL_STATUS_SUCCESS;
+    bool handled;
+
+    switch (cmd_info->cluster_id) {
+    case ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL:
+        handled = level_control_handle_command(endpoint, cmd_info->cmd_id, payload, len);
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_WINDOW_COVERING:
+        handled = cover_control_handle_command(endpoint, cmd_info->cmd_id, payload, len);
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_ON_OFF:
+        // При доставке на группу dst_addr - номер группы
+        handled = APS_FC_DELIVERY_MODE(aps_fc) == APS_DELIVERY_GROUP &&
+                  group_control_handle_on_off(ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).dst_addr,
+                                              ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).source.u.short_addr,
+                                              cmd_info->seq_number, endpoint, cmd_info->cmd_id);
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_SCENES:
+        handled = scene_control_handle_command(APS_FC_DELIVERY_MODE(aps_fc) == APS_DELIVERY_GROUP,
+                                               ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).dst_addr,
+                                               ZB_ZCL_PARSED_HDR_SHORT_DATA(cmd_info).source.u.short_addr,
+                                               cmd_info->seq_number, endpoint, cmd_info->cmd_id, payload, len);
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL:
+        handled = zb_rx_mode_handle_command(endpoint, cmd_info->cmd_id, payload, len, &status);
+        break;
+    case ESP_ZB_ZCL_CLUSTER_ID_GROUPS:
+        // Состав группы меняет стек после нас - кэш пересоберется при следующей команде
+        if (cmd_info->cmd_id == ESP_ZB_ZCL_CMD_GROUPS_REMOVE_ALL_GROUPS) {
+            group_control_clear();
+        } else if ((cmd_info->cmd_id == ESP_ZB_ZCL_CMD_GROUPS_ADD_GROUP ||
+                    cmd_info->cmd_id == ESP_ZB_ZCL_CMD_GROUPS_REMOVE_GROUP ||
+                    cmd_info->cmd_id == ESP_ZB_ZCL_CMD_GROUPS_ADD_GROUP_IF_IDENTIFYING) && len >= 2) {
+            group_control_invalidate(payload[0] | (payload[1] << 8));
+        }
+        handled = false;
+        break;
+    default:
+        handled = false;
+        break;
+    }
+    if (handled) {
+        zb_zcl_send_default_handler(bufid, cmd_info, status);
+    }
+    return handled;
+}
+
 static void esp_zb_task(void *pvParameters)
 {
     // Инициализация стека Zigbee
+#if CONFIG_ZB_ZCZR
+    // Роутер: размер таблиц соседей и маршрутов задается до esp_zb_init()
+    esp_zb_overall_network_size_set(CONFIG_ZB_NETWORK_SIZE);
+    esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZR_CONFIG();
+#else
     esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZED_CONFIG();
+#endif
     esp_zb_init(&zb_nwk_cfg);
 
-    // Создаем список эндпоинтов
+    // Создаем список эндпоинтов по таблице endpoints.csv
+    endpoint_table_init();
+    size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    size_t heap_primary = 0;
     esp_zb_ep_list_t *ep_list = esp_zb_ep_list_create();
-    
-    // Конфигурация кластера On/Off 
-    esp_zb_on_off_cluster_cfg_t on_off_cfg = {
-        .on_off = ESP_ZB_ZCL_ON_OFF_ON_OFF_DEFAULT_VALUE,
-    };
 
-    zcl_basic_manufacturer_info_t info = {
-        .manufacturer_name = "ESP_CUSTOM",
-        .model_identifier = "ESP_LIGHT",
-    };
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        if (i == 1) {
+            heap_primary = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+        }
+        esp_zb_cluster_list_t *cluster_list = esp_zb_zcl_cluster_list_create();
 
-     // Первый эндпоинт
-    esp_zb_cluster_list_t *cluster_list1 = esp_zb_zcl_cluster_list_create();
-    esp_zb_cluster_list_add_basic_cluster(cluster_list1, esp_zb_basic_cluster_create(NULL), ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-    
-    esp_zb_attribute_list_t *on_off_attr_list1 = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF);
-    uint8_t attr_access = 0x02;
-    esp_zb_cluster_add_attr(on_off_attr_list1, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, 
-                           ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, 
-                           ESP_ZB_ZCL_ATTR_TYPE_BOOL, 
-                           ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY,  //явно прописываю write-only
-                           &(bool){false});
-    esp_zb_cluster_list_add_on_off_cluster(cluster_list1, on_off_attr_list1, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-    
-    esp_zb_ep_list_add_ep(ep_list, cluster_list1, 
-                         (esp_zb_endpoint_config_t){
-                             .endpoint = HA_ESP_LIGHT_ENDPOINT,
-                             .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
-                             .app_device_id = ESP_ZB_HA_ON_OFF_LIGHT_DEVICE_ID
-                         });
+        if (ep->clusters & EP_CLUSTER_BASIC) {
+            esp_zb_cluster_list_add_basic_cluster(cluster_list, esp_zb_basic_cluster_create(NULL), ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+            zb_rx_mode_add_clusters(cluster_list, ep->endpoint);
+        }
+        // Groups на каждом эндпоинте: команда на комнату - один кадр вместо N
+        esp_zb_cluster_list_add_groups_cluster(cluster_list, esp_zb_groups_cluster_create(NULL), ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+        if (ep->clusters & EP_CLUSTER_ON_OFF) {
+            esp_zb_attribute_list_t *on_off_attr_list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF);
+            esp_zb_cluster_add_attr(on_off_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF,
+                                   ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID,
+                                   ESP_ZB_ZCL_ATTR_TYPE_BOOL,
+                                   ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING,
+                                   &(bool){false});
+            esp_zb_cluster_list_add_on_off_cluster(cluster_list, on_off_attr_list, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+            esp_zb_cluster_list_add_scenes_cluster(cluster_list, esp_zb_scenes_cluster_create(NULL),
+                                                   ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+        }
+        if (ep->clusters & EP_CLUSTER_LEVEL) {
+            esp_zb_level_cluster_cfg_t level_cfg = { .current_level = LEVEL_MAX };
+            esp_zb_cluster_list_add_level_cluster(cluster_list, esp_zb_level_cluster_create(&level_cfg),
+                                                  ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+        }
+        if (ep->clusters & EP_CLUSTER_WINDOW_COVERING) {
+            esp_zb_window_covering_cluster_cfg_t cover_cfg = {
+                .covering_type = ESP_ZB_ZCL_ATTR_WINDOW_COVERING_TYPE_ROLLERSHADE,
+                .covering_status = ESP_ZB_ZCL_WINDOW_COVERING_CONFIG_STATUS_DEFAULT_VALUE,
+            };
+            esp_zb_attribute_list_t *cover_attr_list = esp_zb_window_covering_cluster_create(&cover_cfg);
+            // Положение до первого хода к упору неизвестно
+            esp_zb_window_covering_cluster_add_attr(cover_attr_list,
+                                                    ESP_ZB_ZCL_ATTR_WINDOW_COVERING_CURRENT_POSITION_LIFT_PERCENTAGE_ID,
+                                                    &(uint8_t){ESP_ZB_ZCL_WINDOW_COVERING_CURRENT_POSITION_LIFT_PERCENTAGE_DEFAULT_VALUE});
+            esp_zb_cluster_list_add_window_covering_cluster(cluster_list, cover_attr_list, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+        }
 
-    // Второй эндпоинт 
-    esp_zb_cluster_list_t *cluster_list2 = esp_zb_zcl_cluster_list_create();
-    esp_zb_cluster_list_add_basic_cluster(cluster_list2, esp_zb_basic_cluster_create(NULL), ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-    
-    esp_zb_attribute_list_t *on_off_attr_list2 = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF);
-    esp_zb_cluster_add_attr(on_off_attr_list2, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, 
-                           ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, 
-                           ESP_ZB_ZCL_ATTR_TYPE_BOOL, 
-                           ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY, //явно прописываю write-only
-                           &(bool){false});
-    esp_zb_cluster_list_add_on_off_cluster(cluster_list2, on_off_attr_list2, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
-    
-    esp_zb_ep_list_add_ep(ep_list, cluster_list2, 
-                         (esp_zb_endpoint_config_t){
-                             .endpoint = HA_ESP_LIGHT_ENDPOINT + 1,
-                             .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
-                             .app_device_id = ESP_ZB_HA_ON_OFF_OUTPUT_DEVICE_ID
-                         });
+        esp_zb_ep_list_add_ep(ep_list, cluster_list,
+                             (esp_zb_endpoint_config_t){
+                                 .endpoint = ep->endpoint,
+                                 .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+                                 .app_device_id = ep->device_id
+                             });
+    }
+
+    size_t heap_built = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    if (ENDPOINT_TABLE_COUNT == 1) {
+        heap_primary = heap_built;
+    }
 
     // Регистрация устройства
     esp_zb_device_register(ep_list);
+    size_t heap_used = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    endpoint_heap_report(heap_primary, heap_built - heap_primary,
+                         heap_used > heap_built ? heap_used - heap_built : 0);
+    ESP_ERROR_CHECK(relay_report_init());
     esp_zb_core_action_handler_register(zb_action_handler);
+    esp_zb_raw_command_handler_register(zb_raw_command_handler);
+    wb_uart_register_state_handler(wb_state_report_handler);
     esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
+    zb_rx_mode_init();
     
     ESP_ERROR_CHECK(esp_zb_start(false));
     esp_zb_stack_main_loop();
@@ -305,11 +370,16 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    // Инициализация UART
-    ESP_ERROR_CHECK(uart_driver_init());
-    
-    // Запуск юарта
-    xTaskCreate(uart_event_task, "uart_task", 2048, NULL, 10, NULL);
+    // Инициализация UART и запуск задач приема/отправки
+    ESP_ERROR_CHECK(wb_uart_init());
+    // Локальные выходы GPIO и переход fallback-эндпоинтов на них без связи
+    ESP_ERROR_CHECK(relay_output_init());
+    // Диммеры: LEDC для gpio, команды уровня для Wiren Board
+    ESP_ERROR_CHECK(level_control_init());
+    // Шторы на парах реле Wiren Board
+    ESP_ERROR_CHECK(cover_control_init());
+    // Сцены, собранные до перезагрузки
+    ESP_ERROR_CHECK(scene_control_init());
 
     // Zigbee конфигцрации
     esp_zb_platform_config_t config = {
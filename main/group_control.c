@@ -0,0 +1,185 @@
+// group_control.c
+#include "group_control.h"
+#include <string.h>
+#include "endpoint_table.h"
+#include "relay_output.h"
+#include "esp_log.h"
+#include "ha/esp_zigbee_ha_standard.h"
+#include "zboss_api.h"
+
+static const char *TAG = "GROUPS";
+
+// Кэш состава групп: открытая адресация, заполнение не больше половины,
+// поэтому поиск - одна-две пробы. Источник истины - таблица групп APS в стеке,
+// кэш строится из нее при первой команде на группу и сбрасывается при
+// изменении состава.
+#define GROUP_CACHE_SIZE  64  // степень двойки
+#define GROUP_CACHE_MAX   (GROUP_CACHE_SIZE / 2)
+#define GROUP_ID_EMPTY    0x0000  // группы ZCL нумеруются с 0x0001
+
+_Static_assert((GROUP_CACHE_SIZE & (GROUP_CACHE_SIZE - 1)) == 0, "GROUP_CACHE_SIZE must be a power of two");
+
+typedef struct {
+    uint16_t group_id;
+    relay_bits_snapshot_t members;  // биты - номера эндпоинтов с On/Off
+} group_entry_t;
+
+static group_entry_t cache[GROUP_CACHE_SIZE];
+static uint32_t cache_used;
+
+// Кадр, уже выполненный для всей группы: его остальные доставки только подтверждаем
+static struct {
+    uint16_t group_id;
+    uint16_t src_addr;
+    uint8_t tsn;
+    relay_bits_snapshot_t pending;  // эндпоинты, чья доставка еще впереди
+} last_frame;
+
+static inline uint32_t group_hash(uint16_t group_id)
+{
+    // Мультипликативный хэш: номера групп обычно идут подряд
+    return (uint16_t)(group_id * 40503u) >> 10;
+}
+
+static inline bool ep_bit(const relay_bits_snapshot_t *bits, uint8_t endpoint)
+{
+    return (bits->w[endpoint / 32] >> (endpoint % 32)) & 1;
+}
+
+static inline void ep_bit_clear(relay_bits_snapshot_t *bits, uint8_t endpoint)
+{
+    bits->w[endpoint / 32] &= ~(1UL << (endpoint % 32));
+}
+
+// Состав группы из таблицы APS: один проход по эндпоинтам на группу
+static void group_build(group_entry_t *e, uint16_t group_id)
+{
+    memset(&e->members, 0, sizeof(e->members));
+    e->group_id = group_id;
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        if ((ep->clusters & EP_CLUSTER_ON_OFF) && zb_aps_is_endpoint_in_group(group_id, ep->endpoint)) {
+            e->members.w[ep->endpoint / 32] |= 1UL << (ep->endpoint % 32);
+        }
+    }
+}
+
+static const group_entry_t *group_lookup(uint16_t group_id)
+{
+    uint32_t i = group_hash(group_id);
+
+    for (;; i++) {
+        group_entry_t *e = &cache[i & (GROUP_CACHE_SIZE - 1)];
+        if (e->group_id == group_id) {
+            return e;
+        }
+        if (e->group_id == GROUP_ID_EMPTY) {
+            if (cache_used >= GROUP_CACHE_MAX) {
+                // Групп больше, чем помещается: начинаем кэш заново
+                group_control_clear();
+                return group_lookup(group_id);
+            }
+            group_build(e, group_id);
+            cache_used++;
+            return e;
+        }
+    }
+}
+
+bool group_control_frame_seen(uint16_t group_id, uint16_t src_addr, uint8_t tsn, uint8_t endpoint)
+{
+    if (last_frame.group_id != group_id || last_frame.src_addr != src_addr || last_frame.tsn != tsn ||
+        !ep_bit(&last_frame.pending, endpoint)) {
+        return false;
+    }
+    ep_bit_clear(&last_frame.pending, endpoint);
+    return true;
+}
+
+void group_control_frame_done(uint16_t group_id, uint16_t src_addr, uint8_t tsn, uint8_t endpoint,
+                              const relay_bits_snapshot_t *members)
+{
+    last_frame.group_id = group_id;
+    last_frame.src_addr = src_addr;
+    last_frame.tsn = tsn;
+    last_frame.pending = *members;
+    ep_bit_clear(&last_frame.pending, endpoint);
+}
+
+bool group_control_members(uint16_t group_id, relay_bits_snapshot_t *members)
+{
+    if (group_id == GROUP_ID_EMPTY) {
+        return false;
+    }
+    *members = group_lookup(group_id)->members;
+    return true;
+}
+
+bool group_control_handle_on_off(uint16_t group_id, uint16_t src_addr, uint8_t tsn,
+                                 uint8_t endpoint, uint8_t cmd_id)
+{
+    if (group_id == GROUP_ID_EMPTY) {
+        return false;
+    }
+    if (cmd_id != ESP_ZB_ZCL_CMD_ON_OFF_OFF_ID && cmd_id != ESP_ZB_ZCL_CMD_ON_OFF_ON_ID &&
+        cmd_id != ESP_ZB_ZCL_CMD_ON_OFF_TOGGLE_ID) {
+        return false;
+    }
+
+    // Повторная доставка уже выполненного кадра другому эндпоинту группы
+    if (group_control_frame_seen(group_id, src_addr, tsn, endpoint)) {
+        return true;
+    }
+
+    const group_entry_t *e = group_lookup(group_id);
+    if (!ep_bit(&e->members, endpoint)) {
+        return false;
+    }
+
+    relay_bits_snapshot_t values = {0};
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        uint32_t word = e->members.w[i];
+        while (word) {
+            uint8_t ep = i * 32 + __builtin_ctz(word);
+            bool state = cmd_id == ESP_ZB_ZCL_CMD_ON_OFF_ON_ID ||
+                         (cmd_id == ESP_ZB_ZCL_CMD_ON_OFF_TOGGLE_ID && !relay_bits_get(&relay_state, ep));
+            if (state) {
+                values.w[i] |= 1UL << (ep % 32);
+            }
+            esp_zb_zcl_set_attribute_val(ep, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                         ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, &state, false);
+            word &= word - 1;
+        }
+    }
+    if (relay_output_apply(&e->members, &values) != ESP_OK) {
+        ESP_LOGW(TAG, "Group 0x%04x: TX queue full", group_id);
+    }
+    group_control_frame_done(group_id, src_addr, tsn, endpoint, &e->members);
+    return true;
+}
+
+void group_control_invalidate(uint16_t group_id)
+{
+    uint32_t i = group_hash(group_id);
+
+    for (;; i++) {
+        group_entry_t *e = &cache[i & (GROUP_CACHE_SIZE - 1)];
+        if (e->group_id == GROUP_ID_EMPTY) {
+            return;
+        }
+        if (e->group_id == group_id) {
+            // Удаление из открытой адресации ломает цепочки проб - проще начать заново
+            group_control_clear();
+            return;
+        }
+    }
+}
+
+void group_control_clear(void)
+{
+    for (int i = 0; i < GROUP_CACHE_SIZE; i++) {
+        cache[i].group_id = GROUP_ID_EMPTY;
+    }
+    cache_used = 0;
+    last_frame.group_id = GROUP_ID_EMPTY;
+}
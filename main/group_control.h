@@ -0,0 +1,30 @@
+// group_control.h
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "relay_state.h"
+
+// Групповые команды On/Off. Стек доставляет кадр на группу каждому
+// эндпоинту группы по отдельности; мы на первой доставке по номеру группы
+// находим всех участников и переключаем их одной командой (один кадр UART
+// или одно обновление катушек Modbus), остальные доставки того же кадра
+// только подтверждаются. Все функции вызываются из задачи Zigbee.
+
+// Команда On/Off, пришедшая на группу group_id. false - не разобрана,
+// ее обработает стек как обычную команду эндпоинту.
+bool group_control_handle_on_off(uint16_t group_id, uint16_t src_addr, uint8_t tsn,
+                                 uint8_t endpoint, uint8_t cmd_id);
+
+// Эндпоинты группы с On/Off (биты - номера эндпоинтов). false - не группа.
+bool group_control_members(uint16_t group_id, relay_bits_snapshot_t *members);
+
+// Учет кадров на группу, выполненных сразу для всех участников: frame_done
+// запоминает кадр, frame_seen возвращает true для его остальных доставок
+void group_control_frame_done(uint16_t group_id, uint16_t src_addr, uint8_t tsn, uint8_t endpoint,
+                              const relay_bits_snapshot_t *members);
+bool group_control_frame_seen(uint16_t group_id, uint16_t src_addr, uint8_t tsn, uint8_t endpoint);
+
+// Состав группы мог измениться (команды кластера Groups, выход из сети)
+void group_control_invalidate(uint16_t group_id);
+void group_control_clear(void);
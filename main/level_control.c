@@ -0,0 +1,286 @@
+// level_control.c
+#include "level_control.h"
+#include <stdlib.h>
+#include "endpoint_table.h"
+#include "relay_state.h"
+#include "wb_uart.h"
+#include "driver/ledc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "soc/soc_caps.h"
+#include "ha/esp_zigbee_ha_standard.h"
+
+static const char *TAG = "LEVEL";
+
+// ШИМ для диммеров на gpio
+#define LEVEL_LEDC_MODE        LEDC_LOW_SPEED_MODE
+#define LEVEL_LEDC_TIMER       LEDC_TIMER_0
+#define LEVEL_LEDC_BITS        LEDC_TIMER_13_BIT
+#define LEVEL_LEDC_FREQ_HZ     5000
+#define LEVEL_DUTY_MAX         ((1 << 13) - 1)
+
+// Значения "по умолчанию" в полях команд
+#define LEVEL_TRANSITION_DEFAULT  0xFFFF
+#define LEVEL_RATE_DEFAULT        0xFF
+#define LEVEL_RATE_FALLBACK       LEVEL_MAX  // единиц в секунду, если скорость не задана
+
+_Static_assert(ENDPOINT_PWM_COUNT <= SOC_LEDC_CHANNEL_NUM,
+               "endpoints.csv has more gpio dimmers than LEDC channels");
+
+// Переход: уровень в любой момент считается по времени от начала
+typedef struct {
+    uint8_t from;
+    uint8_t to;
+    uint8_t on_level;      // последний ненулевой уровень
+    uint8_t ledc_channel;  // только для gpio
+    int64_t start_us;
+    int64_t duration_us;
+} level_fade_t;
+
+static level_fade_t fades[ENDPOINT_LEVEL_COUNT ? ENDPOINT_LEVEL_COUNT : 1];
+static uint8_t fade_slot[ENDPOINT_TABLE_COUNT];  // строка таблицы -> fades
+
+static uint8_t fade_level(const level_fade_t *f, int64_t now)
+{
+    int64_t elapsed = now - f->start_us;
+    if (elapsed >= f->duration_us) {
+        return f->to;
+    }
+    return f->from + ((int)f->to - f->from) * elapsed / (int64_t)f->duration_us;
+}
+
+static level_fade_t *fade_find(uint8_t endpoint, const endpoint_desc_t **desc)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    if (route == NULL || !(route->clusters & EP_CLUSTER_LEVEL)) {
+        return NULL;
+    }
+    *desc = &endpoint_table[route->index];
+    return &fades[fade_slot[route->index]];
+}
+
+// Запуск перехода от текущего уровня к level за transition десятых секунды
+static void fade_start(const endpoint_desc_t *ep, level_fade_t *f, uint8_t level, uint16_t transition)
+{
+    int64_t now = esp_timer_get_time();
+
+    f->from = fade_level(f, now);
+    f->to = level;
+    f->start_us = now;
+    f->duration_us = transition * 100000LL;
+    if (level) {
+        f->on_level = level;
+    }
+
+    if (ep->transport == EP_TRANSPORT_GPIO) {
+        uint32_t duty = (uint32_t)level * LEVEL_DUTY_MAX / LEVEL_MAX;
+        // Новая команда прерывает идущий fade, иначе вызовы ниже ждут его конца
+        ledc_fade_stop(LEVEL_LEDC_MODE, f->ledc_channel);
+        if (transition) {
+            ledc_set_fade_time_and_start(LEVEL_LEDC_MODE, f->ledc_channel, duty, transition * 100,
+                                         LEDC_FADE_NO_WAIT);
+        } else {
+            ledc_set_duty_and_update(LEVEL_LEDC_MODE, f->ledc_channel, duty, 0);
+        }
+    } else {
+        wb_uart_send_level(ep->channel, level, transition);
+    }
+}
+
+// CurrentLevel сразу принимает целевое значение, Stop записывает фактический уровень
+static void level_attr_set(uint8_t endpoint, uint8_t level)
+{
+    esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                                 ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_LEVEL_CONTROL_CURRENT_LEVEL_ID,
+                                 &level, false);
+}
+
+// Команды with On/Off: уровень 0 выключает, любой другой включает
+static void on_off_follow(uint8_t endpoint, uint8_t level)
+{
+    bool on = level > 0;
+    relay_bits_set(&relay_state, endpoint, on);
+    esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF,
+                                 ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID,
+                                 &on, false);
+}
+
+static inline uint16_t get_u16le(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+esp_err_t level_control_init(void)
+{
+    uint8_t slot = 0;
+    uint8_t ledc_channel = 0;
+
+#if ENDPOINT_PWM_COUNT
+    ledc_timer_config_t timer_conf = {
+        .speed_mode = LEVEL_LEDC_MODE,
+        .duty_resolution = LEVEL_LEDC_BITS,
+        .timer_num = LEVEL_LEDC_TIMER,
+        .freq_hz = LEVEL_LEDC_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    esp_err_t ret = ledc_timer_config(&timer_conf);
+    if (ret == ESP_OK) {
+        ret = ledc_fade_func_install(0);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "LEDC init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#endif
+
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        if (!(ep->clusters & EP_CLUSTER_LEVEL)) {
+            continue;
+        }
+        level_fade_t *f = &fades[slot];
+        fade_slot[i] = slot++;
+        f->on_level = LEVEL_MAX;
+        if (ep->transport != EP_TRANSPORT_GPIO) {
+            continue;
+        }
+#if ENDPOINT_PWM_COUNT
+        f->ledc_channel = ledc_channel++;
+        ledc_channel_config_t channel_conf = {
+            .gpio_num = ep->gpio,
+            .speed_mode = LEVEL_LEDC_MODE,
+            .channel = f->ledc_channel,
+            .timer_sel = LEVEL_LEDC_TIMER,
+            .duty = 0,
+        };
+        ret = ledc_channel_config(&channel_conf);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "LEDC channel for GPIO %d failed", ep->gpio);
+            return ret;
+        }
+        ESP_LOGI(TAG, "Dimmer GPIO %d on LEDC channel %d for endpoint %d", ep->gpio, f->ledc_channel, ep->endpoint);
+#endif
+    }
+    if (slot) {
+        ESP_LOGI(TAG, "%d dimmers, %d on LEDC", slot, ledc_channel);
+    }
+    return ESP_OK;
+}
+
+bool level_control_handle_command(uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len)
+{
+    const endpoint_desc_t *ep;
+    level_fade_t *f = fade_find(endpoint, &ep);
+    if (f == NULL) {
+        return false;
+    }
+
+    bool with_on_off = cmd_id >= ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL_WITH_ON_OFF;
+    uint8_t current = fade_level(f, esp_timer_get_time());
+    uint8_t min_level = with_on_off ? 0 : 1;
+    uint8_t level;
+    uint16_t transition;
+
+    // Без with On/Off выключенный диммер команды не меняют
+    if (!with_on_off && !relay_bits_get(&relay_state, endpoint)) {
+        return cmd_id <= ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP;
+    }
+
+    switch (cmd_id) {
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL:
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_TO_LEVEL_WITH_ON_OFF:
+        if (len < 3) {
+            return false;
+        }
+        level = payload[0] > LEVEL_MAX ? LEVEL_MAX : payload[0];
+        transition = get_u16le(&payload[1]);
+        break;
+
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE:
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_MOVE_WITH_ON_OFF: {
+        if (len < 2 || payload[1] == 0) {
+            return false;
+        }
+        // Движение со скоростью rate - тот же переход до края диапазона
+        uint8_t rate = payload[1] == LEVEL_RATE_DEFAULT ? LEVEL_RATE_FALLBACK : payload[1];
+        level = payload[0] == 0 ? LEVEL_MAX : min_level;
+        transition = (abs((int)level - current) * 10 + rate - 1) / rate;
+        break;
+    }
+
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP:
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STEP_WITH_ON_OFF: {
+        if (len < 4) {
+            return false;
+        }
+        int target = payload[0] == 0 ? current + payload[1] : current - payload[1];
+        level = target > LEVEL_MAX ? LEVEL_MAX : target < min_level ? min_level : target;
+        transition = get_u16le(&payload[2]);
+        break;
+    }
+
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP:
+    case ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP_WITH_ON_OFF:
+        level = current;
+        transition = 0;
+        break;
+
+    default:
+        return false;
+    }
+
+    if (transition == LEVEL_TRANSITION_DEFAULT) {
+        transition = 0;
+    }
+    fade_start(ep, f, level, transition);
+    level_attr_set(endpoint, level);
+    if (with_on_off && cmd_id != ESP_ZB_ZCL_CMD_LEVEL_CONTROL_STOP_WITH_ON_OFF) {
+        on_off_follow(endpoint, level);
+    }
+    return true;
+}
+
+void level_control_set_on(uint8_t endpoint, bool on)
+{
+    const endpoint_desc_t *ep;
+    level_fade_t *f = fade_find(endpoint, &ep);
+    if (f != NULL) {
+        fade_start(ep, f, on ? f->on_level : 0, 0);
+    }
+}
+
+uint8_t level_control_get(uint8_t endpoint)
+{
+    const endpoint_desc_t *ep;
+    level_fade_t *f = fade_find(endpoint, &ep);
+    return f ? fade_level(f, esp_timer_get_time()) : 0;
+}
+
+uint8_t level_control_get_on_level(uint8_t endpoint)
+{
+    const endpoint_desc_t *ep;
+    level_fade_t *f = fade_find(endpoint, &ep);
+    return f ? f->on_level : 0;
+}
+
+void level_control_recall(uint8_t endpoint, bool on, uint8_t level, uint16_t transition)
+{
+    const endpoint_desc_t *ep;
+    level_fade_t *f = fade_find(endpoint, &ep);
+    if (f == NULL) {
+        return;
+    }
+
+    level = level > LEVEL_MAX ? LEVEL_MAX : level;
+    if (on && level) {
+        fade_start(ep, f, level, transition);
+        level_attr_set(endpoint, level);
+    } else {
+        // Выключенная сцена запоминает уровень для следующего включения
+        if (level) {
+            f->on_level = level;
+        }
+        fade_start(ep, f, 0, transition);
+    }
+    on_off_follow(endpoint, on && level);
+}
@@ -0,0 +1,31 @@
+// level_control.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define LEVEL_MAX  254  // наибольший CurrentLevel по ZCL
+
+// Диммеры - эндпоинты с кластером level из endpoints.csv. Переход считается
+// на месте по времени: для gpio его ведет аппаратный fade LEDC, в Wiren Board
+// уходит один кадр с целевым уровнем и временем перехода, без шагов по тикам.
+// Все функции вызываются из задачи Zigbee.
+esp_err_t level_control_init(void);
+
+// Команда кластера Level Control из стека. false - команда не разобрана,
+// ее обработает стек.
+bool level_control_handle_command(uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len);
+
+// On/Off диммера: включение возвращает последний ненулевой уровень
+void level_control_set_on(uint8_t endpoint, bool on);
+
+// Уровень с учетом идущего перехода
+uint8_t level_control_get(uint8_t endpoint);
+
+// Уровень, к которому вернет включение: текущая цель или последний ненулевой
+uint8_t level_control_get_on_level(uint8_t endpoint);
+
+// Вызов сцены: состояние On/Off и уровень за transition десятых секунды
+void level_control_recall(uint8_t endpoint, bool on, uint8_t level, uint16_t transition);
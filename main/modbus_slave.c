@@ -0,0 +1,383 @@
+// modbus_slave.c
+#include "modbus_slave.h"
+#include <string.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "relay_state.h"
+
+// CRC-16/MODBUS, полином 0xA001 (отраженный 0x8005), начальное значение 0xFFFF
+static const uint16_t crc16_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+static uint8_t slave_address;
+static uint16_t coil_count;
+static modbus_coils_written_cb_t coils_written_cb;
+static relay_bits_t coils = RELAY_BITS_INITIALIZER;  // слова 0-1: катушки 0..63
+static uint32_t levels[64];  // уровень | время перехода << 16, одной записью
+static modbus_slave_stats_t stats;
+
+uint16_t modbus_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc = (crc >> 8) ^ crc16_table[(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8) | p[1];
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static uint64_t coils_snapshot(void)
+{
+    relay_bits_snapshot_t snap;
+    relay_bits_snapshot(&coils, &snap);
+    return relay_bits_get64(&snap, 0);
+}
+
+// Число регистров хранения, покрывающих все катушки
+static inline uint16_t holding_count(void)
+{
+    return (coil_count + 15) / 16;
+}
+
+static uint16_t input_register(uint16_t addr)
+{
+    uint32_t uptime = esp_timer_get_time() / 1000000;
+
+    switch (addr) {
+    case MODBUS_IR_RX_FRAMES:    return stats.frames;
+    case MODBUS_IR_CRC_ERRORS:   return stats.crc_errors;
+    case MODBUS_IR_EXCEPTIONS:   return stats.exceptions;
+    case MODBUS_IR_COIL_UPDATES: return stats.coil_updates;
+    case MODBUS_IR_UPTIME_LO:    return uptime & 0xFFFF;
+    case MODBUS_IR_UPTIME_HI:    return uptime >> 16;
+    case MODBUS_IR_RELAY_COUNT:  return coil_count;
+    case MODBUS_IR_FREE_HEAP_KB: return esp_get_free_heap_size() / 1024;
+    default:                     return 0;
+    }
+}
+
+// Ответ-исключение: [addr][fc | 0x80][code]
+static size_t exception(uint8_t *resp, uint8_t fc, uint8_t code)
+{
+    stats.exceptions++;
+    resp[1] = fc | 0x80;
+    resp[2] = code;
+    return 3;
+}
+
+static size_t read_coils(const uint8_t *pdu, size_t len, uint8_t *resp)
+{
+    if (len != 5) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    uint16_t start = get_u16(&pdu[1]);
+    uint16_t qty = get_u16(&pdu[3]);
+    if (qty == 0 || qty > 2000) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)start + qty > coil_count) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    uint64_t bits = coils_snapshot() >> start;
+    uint8_t bytes = (qty + 7) / 8;
+    resp[1] = pdu[0];
+    resp[2] = bytes;
+    for (uint8_t i = 0; i < bytes; i++) {
+        resp[3 + i] = bits >> (8 * i);
+    }
+    // Лишние биты последнего байта должны быть нулями
+    if (qty % 8) {
+        resp[2 + bytes] &= (1 << (qty % 8)) - 1;
+    }
+    return 3 + bytes;
+}
+
+static size_t read_input_registers(const uint8_t *pdu, size_t len, uint8_t *resp)
+{
+    if (len != 5) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    uint16_t start = get_u16(&pdu[1]);
+    uint16_t qty = get_u16(&pdu[3]);
+    if (qty == 0 || qty > 125) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)start + qty > MODBUS_IR_COUNT) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    resp[1] = pdu[0];
+    resp[2] = qty * 2;
+    for (uint16_t i = 0; i < qty; i++) {
+        put_u16(&resp[3 + 2 * i], input_register(start + i));
+    }
+    return 3 + qty * 2;
+}
+
+static size_t read_level_registers(const uint8_t *pdu, uint16_t start, uint16_t qty, uint8_t *resp)
+{
+    if ((uint32_t)start + qty > 2u * coil_count) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    resp[1] = pdu[0];
+    resp[2] = qty * 2;
+    for (uint16_t i = 0; i < qty; i++) {
+        uint16_t reg = start + i;
+        uint32_t level = __atomic_load_n(&levels[reg / 2], __ATOMIC_RELAXED);
+        put_u16(&resp[3 + 2 * i], (reg & 1) ? level >> 16 : level & 0xFF);
+    }
+    return 3 + qty * 2;
+}
+
+static size_t read_holding_registers(const uint8_t *pdu, size_t len, uint8_t *resp)
+{
+    if (len != 5) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    uint16_t start = get_u16(&pdu[1]);
+    uint16_t qty = get_u16(&pdu[3]);
+    if (qty == 0 || qty > 125) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    if (start >= MODBUS_HR_LEVEL_BASE) {
+        return read_level_registers(pdu, start - MODBUS_HR_LEVEL_BASE, qty, resp);
+    }
+    if ((uint32_t)start + qty > holding_count()) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    uint64_t bits = coils_snapshot();
+    resp[1] = pdu[0];
+    resp[2] = qty * 2;
+    for (uint16_t i = 0; i < qty; i++) {
+        put_u16(&resp[3 + 2 * i], bits >> (16 * (start + i)));
+    }
+    return 3 + qty * 2;
+}
+
+// Применение записи мастера одним набором: образ катушек и один вызов колбэка
+static bool coils_apply(uint64_t mask, uint64_t values)
+{
+    relay_bits_snapshot_t m = {0}, v = {0};
+    relay_bits_put64(&m, 0, mask);
+    relay_bits_put64(&v, 0, values);
+    return relay_bits_apply(&coils, &m, &v);
+}
+
+static void apply_write(uint64_t mask, uint64_t values)
+{
+    coils_apply(mask, values);
+    if (coils_written_cb) {
+        coils_written_cb(mask, values & mask);
+    }
+}
+
+static size_t write_single_coil(const uint8_t *pdu, size_t len, uint8_t *resp)
+{
+    if (len != 5) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    uint16_t addr = get_u16(&pdu[1]);
+    uint16_t value = get_u16(&pdu[3]);
+    if (value != 0xFF00 && value != 0x0000) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    if (addr >= coil_count) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    uint64_t bit = 1ULL << addr;
+    apply_write(bit, value ? bit : 0);
+
+    // Ответ - эхо запроса
+    memcpy(&resp[1], pdu, 5);
+    return 6;
+}
+
+// Маска из qty бит начиная с start
+static inline uint64_t bit_range(uint16_t start, uint16_t qty)
+{
+    uint64_t mask = qty >= 64 ? UINT64_MAX : (1ULL << qty) - 1;
+    return mask << start;
+}
+
+static size_t write_multiple_coils(const uint8_t *pdu, size_t len, uint8_t *resp)
+{
+    if (len < 6) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    uint16_t start = get_u16(&pdu[1]);
+    uint16_t qty = get_u16(&pdu[3]);
+    uint8_t bytes = pdu[5];
+    if (qty == 0 || qty > 1968 || bytes != (qty + 7) / 8 || len != 6u + bytes) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)start + qty > coil_count) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    uint64_t values = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        values |= (uint64_t)pdu[6 + i] << (8 * i);
+    }
+    stats.bulk_writes++;
+    apply_write(bit_range(start, qty), values << start);
+
+    // Ответ: адрес и количество
+    memcpy(&resp[1], pdu, 5);
+    return 6;
+}
+
+static size_t write_multiple_registers(const uint8_t *pdu, size_t len, uint8_t *resp)
+{
+    if (len < 6) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    uint16_t start = get_u16(&pdu[1]);
+    uint16_t qty = get_u16(&pdu[3]);
+    uint8_t bytes = pdu[5];
+    if (qty == 0 || qty > 123 || bytes != qty * 2 || len != 6u + bytes) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_VALUE);
+    }
+    if ((uint32_t)start + qty > holding_count()) {
+        return exception(resp, pdu[0], MODBUS_EX_ILLEGAL_ADDRESS);
+    }
+
+    uint64_t values = 0;
+    for (uint16_t i = 0; i < qty; i++) {
+        values |= (uint64_t)get_u16(&pdu[6 + 2 * i]) << (16 * (start + i));
+    }
+    // Биты за последней катушкой не трогаем
+    uint64_t mask = bit_range(16 * start, 16 * qty) & bit_range(0, coil_count);
+    stats.bulk_writes++;
+    apply_write(mask, values);
+
+    memcpy(&resp[1], pdu, 5);
+    return 6;
+}
+
+void modbus_slave_init(uint8_t address, uint16_t count, modbus_coils_written_cb_t cb)
+{
+    slave_address = address;
+    coil_count = count > 64 ? 64 : count;
+    coils_written_cb = cb;
+}
+
+void modbus_slave_set_coils(uint64_t mask, uint64_t values)
+{
+    if (coils_apply(mask, values)) {
+        stats.coil_updates++;
+    }
+}
+
+void modbus_slave_set_level(uint8_t channel, uint8_t level, uint16_t transition)
+{
+    if (channel < 64) {
+        __atomic_store_n(&levels[channel], level | (uint32_t)transition << 16, __ATOMIC_RELAXED);
+    }
+}
+
+size_t modbus_slave_process(const uint8_t *req, size_t len, uint8_t *resp, size_t resp_size)
+{
+    // Минимальный кадр: адрес, функция, CRC
+    if (len < 4 || len > MODBUS_ADU_MAX || resp_size < MODBUS_ADU_MAX) {
+        return 0;
+    }
+    uint8_t addr = req[0];
+    if (addr != slave_address && addr != MODBUS_ADDR_BROADCAST) {
+        return 0;
+    }
+    uint16_t crc = req[len - 2] | (req[len - 1] << 8);
+    if (modbus_crc16(req, len - 2) != crc) {
+        stats.crc_errors++;
+        return 0;
+    }
+    stats.frames++;
+
+    const uint8_t *pdu = &req[1];
+    size_t pdu_len = len - 3;
+    size_t n;
+
+    resp[0] = slave_address;
+    switch (pdu[0]) {
+    case MODBUS_FC_READ_COILS:
+        n = read_coils(pdu, pdu_len, resp);
+        break;
+    case MODBUS_FC_READ_HOLDING_REGS:
+        n = read_holding_registers(pdu, pdu_len, resp);
+        break;
+    case MODBUS_FC_READ_INPUT_REGS:
+        n = read_input_registers(pdu, pdu_len, resp);
+        break;
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        n = write_single_coil(pdu, pdu_len, resp);
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        n = write_multiple_coils(pdu, pdu_len, resp);
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_REGS:
+        n = write_multiple_registers(pdu, pdu_len, resp);
+        break;
+    default:
+        n = exception(resp, pdu[0], MODBUS_EX_ILLEGAL_FUNCTION);
+        break;
+    }
+
+    // На широковещательные запросы не отвечаем
+    if (addr == MODBUS_ADDR_BROADCAST) {
+        return 0;
+    }
+    crc = modbus_crc16(resp, n);
+    resp[n++] = crc & 0xFF;
+    resp[n++] = crc >> 8;
+    return n;
+}
+
+void modbus_slave_get_stats(modbus_slave_stats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,71 @@
+// modbus_slave.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MODBUS_ADU_MAX          256  // максимальный кадр RTU
+#define MODBUS_ADDR_BROADCAST   0
+
+// Функции Modbus
+#define MODBUS_FC_READ_COILS            0x01
+#define MODBUS_FC_READ_HOLDING_REGS     0x03
+#define MODBUS_FC_READ_INPUT_REGS       0x04
+#define MODBUS_FC_WRITE_SINGLE_COIL     0x05
+#define MODBUS_FC_WRITE_MULTIPLE_COILS  0x0F
+#define MODBUS_FC_WRITE_MULTIPLE_REGS   0x10
+
+// Коды исключений
+#define MODBUS_EX_ILLEGAL_FUNCTION      0x01
+#define MODBUS_EX_ILLEGAL_ADDRESS       0x02
+#define MODBUS_EX_ILLEGAL_VALUE         0x03
+
+// Регистры хранения (FC03/FC16): регистр k = катушки 16k..16k+15,
+// младший бит - катушка 16k. Запись регистра меняет сразу 16 реле.
+
+// Диммеры (только чтение FC03): регистр MODBUS_HR_LEVEL_BASE + 2i - целевой
+// уровень канала i (0..254), следующий - время перехода в 1/10 с.
+#define MODBUS_HR_LEVEL_BASE  0x100
+
+// Карта входных регистров (FC04): диагностика моста
+enum {
+    MODBUS_IR_RX_FRAMES = 0,   // принято кадров с нашим адресом
+    MODBUS_IR_CRC_ERRORS,      // кадров с неверной CRC
+    MODBUS_IR_EXCEPTIONS,      // отправлено исключений
+    MODBUS_IR_COIL_UPDATES,    // изменений катушек со стороны Zigbee
+    MODBUS_IR_UPTIME_LO,       // время работы, секунды
+    MODBUS_IR_UPTIME_HI,
+    MODBUS_IR_RELAY_COUNT,     // число реле (катушек)
+    MODBUS_IR_FREE_HEAP_KB,    // свободная куча, КБ
+    MODBUS_IR_COUNT
+};
+
+// Мастер записал катушки: mask - какие каналы, values - новое состояние.
+// Вызывается из задачи приема, один раз на запрос (FC05, FC15 или FC16).
+typedef void (*modbus_coils_written_cb_t)(uint64_t mask, uint64_t values);
+
+typedef struct {
+    uint32_t frames;      // обработано запросов с нашим или широковещательным адресом
+    uint32_t crc_errors;
+    uint32_t exceptions;
+    uint32_t coil_updates;
+    uint32_t bulk_writes;  // запросов FC15/FC16
+} modbus_slave_stats_t;
+
+uint16_t modbus_crc16(const uint8_t *data, size_t len);
+
+// Катушка i = канал реле i (эндпоинт канала задает endpoints.csv)
+void modbus_slave_init(uint8_t address, uint16_t coil_count, modbus_coils_written_cb_t cb);
+
+// Обновление катушек по командам из Zigbee
+void modbus_slave_set_coils(uint64_t mask, uint64_t values);
+
+// Новый целевой уровень диммера, мастер заберет его опросом
+void modbus_slave_set_level(uint8_t channel, uint8_t level, uint16_t transition);
+
+// Обработка одного кадра RTU. Возвращает длину ответа в resp или 0,
+// если отвечать не нужно (чужой адрес, широковещательный запрос, битая CRC).
+size_t modbus_slave_process(const uint8_t *req, size_t len, uint8_t *resp, size_t resp_size);
+
+void modbus_slave_get_stats(modbus_slave_stats_t *stats);
@@ -1,53 +1,129 @@
 // multi_endpoint.c
 #include "multi_endpoint.h"
+#include "endpoint_table.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "soc/soc_caps.h"
+#if SOC_DEDICATED_GPIO_SUPPORTED
+#include "driver/dedic_gpio.h"
+#endif
 
 static const char *TAG = "MULTI_ENDPOINT";
 
-typedef struct {
-    uint8_t endpoint;
-    gpio_num_t gpio_pin;
-    bool state;
-} endpoint_config_t;
+// Строки таблицы с локальным выходом, в порядке битов набора
+static uint8_t gpio_rows[ENDPOINT_GPIO_COUNT ? ENDPOINT_GPIO_COUNT : 1];
+static uint8_t gpio_row_count;
 
-static endpoint_config_t endpoints[] = {
-    {HA_ESP_LIGHT_ENDPOINT, GPIO_NUM_3, false},  // Первый эндпоинт на GPIO3
-    {HA_ESP_LIGHT_ENDPOINT + 1, GPIO_NUM_4, false}  // Второй эндпоинт на GPIO4
-};
+#if SOC_DEDICATED_GPIO_SUPPORTED
+_Static_assert(ENDPOINT_GPIO_COUNT <= SOC_DEDIC_GPIO_OUT_CHANNELS_NUM,
+               "endpoints.csv has more gpio outputs than dedicated GPIO channels");
+
+static dedic_gpio_bundle_handle_t bundle;
+static uint8_t bundle_bit[ENDPOINT_TABLE_COUNT];  // строка таблицы -> бит набора
+
+// Без блокировок и логов: set и clear - две соседние инструкции CSR
+static inline void outputs_write(uint32_t mask, uint32_t values)
+{
+    dedic_gpio_bundle_write(bundle, mask, values);
+}
+#else
+static inline void outputs_write(uint32_t mask, uint32_t values)
+{
+    while (mask) {
+        int bit = __builtin_ctz(mask);
+        gpio_set_level(endpoint_table[gpio_rows[bit]].gpio, (values >> bit) & 1);
+        mask &= mask - 1;
+    }
+}
+#endif
 
 esp_err_t multi_endpoint_init(void) {
-    for (int i = 0; i < sizeof(endpoints)/sizeof(endpoint_config_t); i++) {
+    int gpios[ENDPOINT_GPIO_COUNT ? ENDPOINT_GPIO_COUNT : 1];
+
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        // Выходы диммеров ведет level_control через LEDC
+        if (ep->gpio == EP_GPIO_NONE || (ep->clusters & EP_CLUSTER_LEVEL)) {
+            continue;
+        }
         gpio_config_t io_conf = {
-            .pin_bit_mask = (1ULL << endpoints[i].gpio_pin),
+            .pin_bit_mask = (1ULL << ep->gpio),
             .mode = GPIO_MODE_OUTPUT,
             .pull_up_en = GPIO_PULLUP_DISABLE,
             .pull_down_en = GPIO_PULLDOWN_DISABLE,
             .intr_type = GPIO_INTR_DISABLE,
         };
-        gpio_config(&io_conf);
-        gpio_set_level(endpoints[i].gpio_pin, endpoints[i].state);
-        ESP_LOGI(TAG, "GPIO %d initialized to %s for endpoint %d", 
-                endpoints[i].gpio_pin, 
-                endpoints[i].state ? "ON" : "OFF",
-                endpoints[i].endpoint);
+        esp_err_t ret = gpio_config(&io_conf);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "GPIO %d config failed for endpoint %d", ep->gpio, ep->endpoint);
+            return ret;
+        }
+        gpio_set_level(ep->gpio, 0);
+#if SOC_DEDICATED_GPIO_SUPPORTED
+        bundle_bit[i] = gpio_row_count;
+#endif
+        gpios[gpio_row_count] = ep->gpio;
+        gpio_rows[gpio_row_count++] = i;
+        ESP_LOGI(TAG, "GPIO %d initialized to OFF for endpoint %d", ep->gpio, ep->endpoint);
+    }
+
+#if SOC_DEDICATED_GPIO_SUPPORTED
+    if (gpio_row_count == 0) {
+        return ESP_OK;
+    }
+    dedic_gpio_bundle_config_t bundle_conf = {
+        .gpio_array = gpios,
+        .array_size = gpio_row_count,
+        .flags = {
+            .out_en = 1,
+        },
+    };
+    esp_err_t ret = dedic_gpio_new_bundle(&bundle_conf, &bundle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Dedicated GPIO bundle failed: %s", esp_err_to_name(ret));
+        return ret;
     }
+    outputs_write((1UL << gpio_row_count) - 1, 0);
+    ESP_LOGI(TAG, "%d GPIO outputs in dedicated bundle", gpio_row_count);
+#else
+    (void)gpios;
+#endif
     return ESP_OK;
 }
 
 
 esp_err_t multi_endpoint_set_state(uint8_t endpoint, bool state) {
-    for (int i = 0; i < sizeof(endpoints)/sizeof(endpoint_config_t); i++) {
-        if (endpoints[i].endpoint == endpoint) {
-            gpio_set_level(endpoints[i].gpio_pin, state);
-            endpoints[i].state = state;
-            ESP_LOGI(TAG, "GPIO %d set to %s for endpoint %d", 
-                    endpoints[i].gpio_pin, 
-                    state ? "ON" : "OFF",
-                    endpoint);
-            return ESP_OK;
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    if (route == NULL || endpoint_table[route->index].gpio == EP_GPIO_NONE ||
+        (route->clusters & EP_CLUSTER_LEVEL)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+#if SOC_DEDICATED_GPIO_SUPPORTED
+    uint32_t bit = 1UL << bundle_bit[route->index];
+    outputs_write(bit, state ? bit : 0);
+#else
+    gpio_set_level(endpoint_table[route->index].gpio, state);
+#endif
+    return ESP_OK;
+}
+
+void multi_endpoint_apply(const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values)
+{
+    uint32_t out_mask = 0;
+    uint32_t out_values = 0;
+
+    // Биты эндпоинтов -> биты набора
+    for (int bit = 0; bit < gpio_row_count; bit++) {
+        uint8_t endpoint = endpoint_table[gpio_rows[bit]].endpoint;
+        uint32_t ep_bit = 1UL << (endpoint % 32);
+        if (mask->w[endpoint / 32] & ep_bit) {
+            out_mask |= 1UL << bit;
+            if (values->w[endpoint / 32] & ep_bit) {
+                out_values |= 1UL << bit;
+            }
         }
     }
-    ESP_LOGE(TAG, "Endpoint %d not found", endpoint);
-    return ESP_ERR_NOT_FOUND;
-}
\ No newline at end of file
+    if (out_mask) {
+        outputs_write(out_mask, out_values);
+    }
+}
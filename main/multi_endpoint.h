@@ -3,8 +3,15 @@
 
 #include "esp_err.h"
 #include "ha/esp_zigbee_ha_standard.h"
+#include "relay_state.h"
 
-#define HA_ESP_LIGHT_ENDPOINT 10  // Базовый эндпоинт
-
+// Локальные выходы GPIO эндпоинтов из endpoints.csv (транспорт gpio, both, fallback).
+// Все выходы собраны в один набор выделенных GPIO (dedicated GPIO bundle),
+// поэтому несколько реле переключаются одной записью регистра. Здесь только
+// запись в выходы; relay_state и выбор транспорта - в relay_output.
 esp_err_t multi_endpoint_init(void);
-esp_err_t multi_endpoint_set_state(uint8_t endpoint, bool state);
\ No newline at end of file
+esp_err_t multi_endpoint_set_state(uint8_t endpoint, bool state);
+
+// Групповое переключение: mask/values индексируются номером эндпоинта,
+// как relay_state. Эндпоинты без локального выхода пропускаются.
+void multi_endpoint_apply(const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values);
@@ -0,0 +1,148 @@
+// relay_output.c
+#include "relay_output.h"
+#include "endpoint_table.h"
+#include "level_control.h"
+#include "multi_endpoint.h"
+#include "wb_uart.h"
+#include "esp_log.h"
+
+static const char *TAG = "RELAY_OUTPUT";
+
+// Эндпоинты, которые сейчас ведет локальный GPIO: gpio и both всегда,
+// fallback - пока нет связи с Wiren Board. Проверка бита и запись в выход
+// идут под одной блокировкой, чтобы смена связи не вклинилась между ними.
+static portMUX_TYPE output_lock = portMUX_INITIALIZER_UNLOCKED;
+static relay_bits_snapshot_t local_active;
+static relay_bits_snapshot_t fallback_mask;
+
+static inline bool endpoint_bit(const relay_bits_snapshot_t *bits, uint8_t endpoint)
+{
+    return (bits->w[endpoint / 32] >> (endpoint % 32)) & 1;
+}
+
+// Вызывается задачей отправки UART
+static void link_changed(bool up)
+{
+    relay_bits_snapshot_t values = {0};
+
+    portENTER_CRITICAL(&output_lock);
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        local_active.w[i] = up ? local_active.w[i] & ~fallback_mask.w[i]
+                               : local_active.w[i] | fallback_mask.w[i];
+    }
+    if (!up) {
+        // Выходы подхватывают последнее состояние из Zigbee
+        relay_bits_snapshot(&relay_state, &values);
+    }
+    // При восстановлении связи Wiren Board уже получил все каналы - выходы отпускаем
+    multi_endpoint_apply(&fallback_mask, &values);
+    portEXIT_CRITICAL(&output_lock);
+
+    ESP_LOGW(TAG, "Fallback endpoints on %s", up ? "Wiren Board" : "local GPIO");
+}
+
+esp_err_t relay_output_init(void)
+{
+    esp_err_t ret = multi_endpoint_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        uint32_t bit = 1UL << (ep->endpoint % 32);
+        if (ep->transport == EP_TRANSPORT_FALLBACK) {
+            fallback_mask.w[ep->endpoint / 32] |= bit;
+        } else if (ep->transport == EP_TRANSPORT_GPIO || ep->transport == EP_TRANSPORT_BOTH) {
+            local_active.w[ep->endpoint / 32] |= bit;
+        }
+    }
+
+    // Сначала подписка, потом текущее состояние: смена между ними применится повторно
+    wb_uart_register_link_handler(link_changed);
+    if (!wb_uart_link_up()) {
+        portENTER_CRITICAL(&output_lock);
+        for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+            local_active.w[i] |= fallback_mask.w[i];
+        }
+        portEXIT_CRITICAL(&output_lock);
+    }
+    return ESP_OK;
+}
+
+esp_err_t relay_output_set(uint8_t endpoint, bool state)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    if (route == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    relay_bits_set(&relay_state, endpoint, state);
+    // У диммера On/Off - это переход уровня, а не реле
+    if (route->clusters & EP_CLUSTER_LEVEL) {
+        level_control_set_on(endpoint, state);
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&output_lock);
+    if (endpoint_bit(&local_active, endpoint)) {
+        multi_endpoint_set_state(endpoint, state);
+    }
+    portEXIT_CRITICAL(&output_lock);
+
+    // fallback-каналы ставятся в очередь и без связи: команды лягут в теневое
+    // состояние и уйдут Wiren Board повтором после восстановления
+    if (endpoint_transport_has_uart(route->transport)) {
+        // Только постановка в очередь, запись в UART делает отдельная задача
+        return wb_uart_send_relay(route->channel, state);
+    }
+    return ESP_OK;
+}
+
+void relay_output_mirror(const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values)
+{
+    relay_bits_snapshot_t active;
+
+    portENTER_CRITICAL(&output_lock);
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        active.w[i] = mask->w[i] & local_active.w[i];
+    }
+    multi_endpoint_apply(&active, values);
+    portEXIT_CRITICAL(&output_lock);
+}
+
+esp_err_t relay_output_apply(const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values)
+{
+    relay_bits_snapshot_t active;
+    uint64_t channel_mask = 0;
+    uint64_t channel_values = 0;
+
+    relay_bits_apply(&relay_state, mask, values);
+    portENTER_CRITICAL(&output_lock);
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        active.w[i] = mask->w[i] & local_active.w[i];
+    }
+    multi_endpoint_apply(&active, values);
+    portEXIT_CRITICAL(&output_lock);
+
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        uint32_t word = mask->w[i];
+        while (word) {
+            uint8_t endpoint = i * 32 + __builtin_ctz(word);
+            bool state = endpoint_bit(values, endpoint);
+            const endpoint_route_t *route = endpoint_table_route(endpoint);
+            word &= word - 1;
+            if (route == NULL) {
+                continue;
+            }
+            if (route->clusters & EP_CLUSTER_LEVEL) {
+                level_control_set_on(endpoint, state);
+            } else if (endpoint_transport_has_uart(route->transport)) {
+                channel_mask |= 1ULL << route->channel;
+                channel_values |= (uint64_t)state << route->channel;
+            }
+        }
+    }
+    // Все каналы Wiren Board - одной пачкой, одним кадром
+    return wb_uart_send_relays(channel_mask, channel_values);
+}
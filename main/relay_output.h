@@ -0,0 +1,26 @@
+// relay_output.h
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "relay_state.h"
+
+// Вывод команд эндпоинтов. Куда уходит команда, задает столбец transport
+// в endpoints.csv: реле Wiren Board, локальный GPIO или оба. Эндпоинты
+// fallback при потере связи с Wiren Board переходят на свой GPIO и
+// возвращаются к Wiren Board после повтора состояния всех каналов.
+
+// Локальные выходы и подписка на состояние связи, после wb_uart_init()
+esp_err_t relay_output_init(void);
+
+// Команда из Zigbee: обновляет relay_state и выходы эндпоинта. Не блокирует.
+esp_err_t relay_output_set(uint8_t endpoint, bool state);
+
+// Команда сразу для набора эндпоинтов (биты - номера эндпоинтов): локальные
+// выходы - одной записью, каналы Wiren Board - одной пачкой в очереди
+esp_err_t relay_output_apply(const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values);
+
+// Отчет Wiren Board о фактическом состоянии (биты - номера эндпоинтов)
+// повторяется на локальных выходах, которые сейчас ведут эти эндпоинты
+void relay_output_mirror(const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values);
@@ -0,0 +1,85 @@
+// relay_report.c
+#include "relay_report.h"
+#include "endpoint_table.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_zigbee_core.h"
+#include "ha/esp_zigbee_ha_standard.h"
+
+static const char *TAG = "RELAY_REPORT";
+
+static relay_bits_snapshot_t dirty;     // изменились, атрибут еще не обновлен
+static relay_bits_snapshot_t on_off_eps;  // эндпоинты с атрибутом On/Off
+static uint8_t flush_pending;
+
+// Задача Zigbee: атрибуты изменившихся эндпоинтов получают текущее состояние.
+// Если за окно реле вернулось в прежнее, значение не меняется и стек
+// отчет не шлет.
+static void relay_report_flush(uint8_t param)
+{
+    (void)param;
+
+    // Сначала снимаем флаг: изменения после этой точки запланируют новый проход
+    __atomic_store_n(&flush_pending, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        uint32_t word = __atomic_exchange_n(&dirty.w[i], 0, __ATOMIC_ACQ_REL) & on_off_eps.w[i];
+        while (word) {
+            uint8_t endpoint = i * 32 + __builtin_ctz(word);
+            bool state = relay_bits_get(&relay_state, endpoint);
+            esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF,
+                                         ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID,
+                                         &state, false);
+            word &= word - 1;
+        }
+    }
+}
+
+void relay_report_mark(const relay_bits_snapshot_t *changed)
+{
+    bool any = false;
+
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        if (changed->w[i] & on_off_eps.w[i]) {
+            __atomic_fetch_or(&dirty.w[i], changed->w[i] & on_off_eps.w[i], __ATOMIC_RELEASE);
+            any = true;
+        }
+    }
+    if (!any || __atomic_exchange_n(&flush_pending, 1, __ATOMIC_ACQ_REL)) {
+        return;  // нечего сообщать или проход уже запланирован
+    }
+    esp_zb_lock_acquire(portMAX_DELAY);
+    esp_zb_scheduler_alarm(relay_report_flush, 0, CONFIG_RELAY_REPORT_COALESCE_MS);
+    esp_zb_lock_release();
+}
+
+esp_err_t relay_report_init(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < ENDPOINT_TABLE_COUNT; i++) {
+        const endpoint_desc_t *ep = &endpoint_table[i];
+        if (!(ep->clusters & EP_CLUSTER_ON_OFF)) {
+            continue;
+        }
+        esp_zb_zcl_reporting_info_t info = {
+            .direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV,
+            .ep = ep->endpoint,
+            .cluster_id = ESP_ZB_ZCL_CLUSTER_ID_ON_OFF,
+            .cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+            .attr_id = ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID,
+            .u.send_info.min_interval = CONFIG_RELAY_REPORT_MIN_INTERVAL,
+            .u.send_info.max_interval = CONFIG_RELAY_REPORT_MAX_INTERVAL,
+            .u.send_info.def_min_interval = CONFIG_RELAY_REPORT_MIN_INTERVAL,
+            .u.send_info.def_max_interval = CONFIG_RELAY_REPORT_MAX_INTERVAL,
+            .u.send_info.delta.u8 = 1,
+            .dst.profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+            .manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC,
+        };
+        ESP_RETURN_ON_ERROR(esp_zb_zcl_update_reporting_info(&info), TAG, "reporting EP%d", ep->endpoint);
+        on_off_eps.w[ep->endpoint / 32] |= 1UL << (ep->endpoint % 32);
+        count++;
+    }
+    ESP_LOGI(TAG, "On/Off reporting on %d endpoints: min %ds, max %ds, window %dms", count,
+             CONFIG_RELAY_REPORT_MIN_INTERVAL, CONFIG_RELAY_REPORT_MAX_INTERVAL, CONFIG_RELAY_REPORT_COALESCE_MS);
+    return ESP_OK;
+}
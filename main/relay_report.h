@@ -0,0 +1,19 @@
+// relay_report.h
+#pragma once
+
+#include "esp_err.h"
+#include "relay_state.h"
+
+// Отчеты On/Off о состоянии реле. Атрибут обновляется только у эндпоинтов,
+// чье состояние в relay_state действительно изменилось; всплеск изменений
+// (кадр Wiren Board с несколькими каналами, дребезг выключателя) собирается
+// окном menuconfig -> "Zigbee reporting" и выдается одним проходом в задаче
+// Zigbee. Сами отчеты по привязкам шлет стек по настройкам min/max, хаб
+// может их перенастроить через Configure Reporting.
+
+// Настройки отчетов для всех эндпоинтов On/Off, после esp_zb_device_register()
+esp_err_t relay_report_init(void);
+
+// Эндпоинты changed изменили состояние в relay_state. Вызывается из любой
+// задачи; блокировка стека берется один раз на окно, а не на каждый вызов.
+void relay_report_mark(const relay_bits_snapshot_t *changed);
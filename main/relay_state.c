@@ -0,0 +1,78 @@
+// relay_state.c
+#include "relay_state.h"
+
+relay_bits_t relay_state = RELAY_BITS_INITIALIZER;
+
+// Писатели набора битов сериализуются спинлоком; читатели его не берут и
+// повторяют снимок, если счетчик версий изменился или был нечетным.
+// Одиночный бит меняет счетчик на 2, не трогая его четность.
+static inline void write_begin(relay_bits_t *bits)
+{
+    portENTER_CRITICAL(&bits->lock);
+    __atomic_fetch_add(&bits->seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_end(relay_bits_t *bits)
+{
+    __atomic_fetch_add(&bits->seq, 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&bits->lock);
+}
+
+void relay_bits_set(relay_bits_t *bits, unsigned bit, bool value)
+{
+    uint32_t mask = 1UL << (bit % 32);
+    uint32_t *word = &bits->w[bit / 32];
+
+    if (value) {
+        __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(word, ~mask, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&bits->seq, 2, __ATOMIC_RELEASE);
+}
+
+bool relay_bits_apply(relay_bits_t *bits, const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values)
+{
+    uint32_t changed = 0;
+
+    write_begin(bits);
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        if (mask->w[i]) {
+            // relay_bits_set может поменять другой бит того же слова без спинлока
+            uint32_t prev = __atomic_load_n(&bits->w[i], __ATOMIC_RELAXED);
+            uint32_t next;
+            do {
+                next = (prev & ~mask->w[i]) | (values->w[i] & mask->w[i]);
+            } while (!__atomic_compare_exchange_n(&bits->w[i], &prev, next, true,
+                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            changed |= next ^ prev;
+        }
+    }
+    write_end(bits);
+    return changed != 0;
+}
+
+void relay_bits_snapshot(const relay_bits_t *bits, relay_bits_snapshot_t *out)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&bits->seq, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+            out->w[i] = __atomic_load_n(&bits->w[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&bits->seq, __ATOMIC_RELAXED));
+}
+
+bool relay_bits_diff(const relay_bits_snapshot_t *a, const relay_bits_snapshot_t *b, relay_bits_snapshot_t *changed)
+{
+    uint32_t any = 0;
+
+    for (int i = 0; i < RELAY_BITS_WORDS; i++) {
+        changed->w[i] = a->w[i] ^ b->w[i];
+        any |= changed->w[i];
+    }
+    return any != 0;
+}
@@ -0,0 +1,66 @@
+// relay_state.h
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Битовое множество состояний реле: 256 бит в 32-битных словах.
+// Одиночный бит пишется атомарной операцией над словом, без блокировок.
+// Запись набора битов (relay_bits_apply) идет под спинлоком, который
+// сериализует только такие записи и никогда не ждет планировщик.
+// Чтение без блокировок: одиночный бит - одно слово, снимок целиком -
+// под счетчиком версий (seqlock) с повтором при гонке.
+#define RELAY_BITS_COUNT  256
+#define RELAY_BITS_WORDS  (RELAY_BITS_COUNT / 32)
+
+typedef struct {
+    uint32_t w[RELAY_BITS_WORDS];
+} relay_bits_snapshot_t;
+
+typedef struct {
+    uint32_t w[RELAY_BITS_WORDS];
+    uint32_t seq;       // нечетный - идет запись
+    portMUX_TYPE lock;  // только между писателями relay_bits_apply
+} relay_bits_t;
+
+#define RELAY_BITS_INITIALIZER  { .lock = portMUX_INITIALIZER_UNLOCKED }
+
+// Общее состояние реле, бит = номер эндпоинта. Пишут обработчик Zigbee,
+// задача приема UART (отчеты Wiren Board) и выходы GPIO.
+extern relay_bits_t relay_state;
+
+void relay_bits_set(relay_bits_t *bits, unsigned bit, bool value);
+
+static inline bool relay_bits_get(const relay_bits_t *bits, unsigned bit)
+{
+    return (__atomic_load_n(&bits->w[bit / 32], __ATOMIC_RELAXED) >> (bit % 32)) & 1;
+}
+
+// Запись набора битов одной операцией: биты из mask получают значения из values.
+// Возвращает true, если хотя бы один бит изменился.
+bool relay_bits_apply(relay_bits_t *bits, const relay_bits_snapshot_t *mask, const relay_bits_snapshot_t *values);
+
+// Согласованный снимок всех слов
+void relay_bits_snapshot(const relay_bits_t *bits, relay_bits_snapshot_t *out);
+
+// Номер версии: меняется при каждой записи, дешевая проверка "что-то изменилось"
+static inline uint32_t relay_bits_version(const relay_bits_t *bits)
+{
+    return __atomic_load_n(&bits->seq, __ATOMIC_ACQUIRE);
+}
+
+// Маска изменившихся битов между снимками. false - снимки совпадают.
+bool relay_bits_diff(const relay_bits_snapshot_t *a, const relay_bits_snapshot_t *b, relay_bits_snapshot_t *changed);
+
+// 64 бита начиная со слова word (word четный) - для масок каналов uint64_t
+static inline uint64_t relay_bits_get64(const relay_bits_snapshot_t *snap, unsigned word)
+{
+    return snap->w[word] | ((uint64_t)snap->w[word + 1] << 32);
+}
+
+static inline void relay_bits_put64(relay_bits_snapshot_t *snap, unsigned word, uint64_t value)
+{
+    snap->w[word] = (uint32_t)value;
+    snap->w[word + 1] = (uint32_t)(value >> 32);
+}
@@ -0,0 +1,380 @@
+// scene_control.c
+#include "scene_control.h"
+#include <stdio.h>
+#include <string.h>
+#include "endpoint_table.h"
+#include "group_control.h"
+#include "level_control.h"
+#include "relay_output.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "zboss_api.h"
+
+static const char *TAG = "SCENES";
+
+#define SCENE_TABLE_SIZE     16
+#define SCENE_NVS_NAMESPACE  "scenes"
+#define SCENE_LEVELS_MAX     (ENDPOINT_LEVEL_COUNT ? ENDPOINT_LEVEL_COUNT : 1)
+
+typedef struct {
+    uint8_t endpoint;
+    uint8_t level;
+} scene_level_t;
+
+// Запись сцены в том виде, в котором она выполняется. Размер записи
+// зависит от числа диммеров: после смены таблицы эндпоинтов старые
+// записи в NVS не подходят по размеру и отбрасываются.
+typedef struct {
+    uint8_t used;
+    uint8_t scene_id;
+    uint16_t group_id;
+    uint16_t transition;          // 1/10 с, из Add Scene
+    uint8_t level_count;
+    relay_bits_snapshot_t set;    // эндпоинты, которые сцена включает
+    relay_bits_snapshot_t clear;  // и выключает
+    scene_level_t levels[SCENE_LEVELS_MAX];
+} scene_entry_t;
+
+static scene_entry_t scenes[SCENE_TABLE_SIZE];
+
+static inline bool ep_bit(const relay_bits_snapshot_t *bits, uint8_t endpoint)
+{
+    return (bits->w[endpoint / 32] >> (endpoint % 32)) & 1;
+}
+
+static inline void ep_bit_put(relay_bits_snapshot_t *bits, uint8_t endpoint, bool value)
+{
+    uint32_t bit = 1UL << (endpoint % 32);
+    bits->w[endpoint / 32] = value ? bits->w[endpoint / 32] | bit : bits->w[endpoint / 32] & ~bit;
+}
+
+static inline uint16_t get_u16le(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void scene_save(const scene_entry_t *e)
+{
+    nvs_handle_t nvs;
+    char key[8];
+
+    snprintf(key, sizeof(key), "s%d", (int)(e - scenes));
+    if (nvs_open(SCENE_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "NVS open failed, scene not persisted");
+        return;
+    }
+    esp_err_t ret = e->used ? nvs_set_blob(nvs, key, e, sizeof(*e)) : nvs_erase_key(nvs, key);
+    if (ret == ESP_OK || ret == ESP_ERR_NVS_NOT_FOUND) {
+        ret = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "NVS write %s failed: %s", key, esp_err_to_name(ret));
+    }
+}
+
+static scene_entry_t *scene_find(uint16_t group_id, uint8_t scene_id)
+{
+    for (int i = 0; i < SCENE_TABLE_SIZE; i++) {
+        if (scenes[i].used && scenes[i].group_id == group_id && scenes[i].scene_id == scene_id) {
+            return &scenes[i];
+        }
+    }
+    return NULL;
+}
+
+static scene_entry_t *scene_alloc(uint16_t group_id, uint8_t scene_id)
+{
+    scene_entry_t *e = scene_find(group_id, scene_id);
+    for (int i = 0; e == NULL && i < SCENE_TABLE_SIZE; i++) {
+        if (!scenes[i].used) {
+            e = &scenes[i];
+            memset(e, 0, sizeof(*e));
+            e->used = 1;
+            e->group_id = group_id;
+            e->scene_id = scene_id;
+        }
+    }
+    if (e == NULL) {
+        ESP_LOGW(TAG, "Scene table full, group 0x%04x scene %d not compiled", group_id, scene_id);
+    }
+    return e;
+}
+
+static int scene_level_index(const scene_entry_t *e, uint8_t endpoint)
+{
+    for (int i = 0; i < e->level_count; i++) {
+        if (e->levels[i].endpoint == endpoint) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool scene_has_endpoint(const scene_entry_t *e, uint8_t endpoint)
+{
+    return ep_bit(&e->set, endpoint) || ep_bit(&e->clear, endpoint) || scene_level_index(e, endpoint) >= 0;
+}
+
+static void scene_remove_endpoint(scene_entry_t *e, uint8_t endpoint)
+{
+    int i = scene_level_index(e, endpoint);
+
+    ep_bit_put(&e->set, endpoint, false);
+    ep_bit_put(&e->clear, endpoint, false);
+    if (i >= 0) {
+        e->levels[i] = e->levels[--e->level_count];
+    }
+
+    bool empty = e->level_count == 0;
+    for (int w = 0; w < RELAY_BITS_WORDS; w++) {
+        empty = empty && !(e->set.w[w] | e->clear.w[w]);
+    }
+    if (empty) {
+        e->used = 0;
+    }
+}
+
+// has_on_off = false: состояние On/Off эндпоинта в сцену не входит
+static void scene_put_endpoint(scene_entry_t *e, uint8_t endpoint, bool has_on_off, bool on,
+                               bool has_level, uint8_t level)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+
+    scene_remove_endpoint(e, endpoint);
+    e->used = 1;
+    if (has_on_off) {
+        ep_bit_put(on ? &e->set : &e->clear, endpoint, true);
+    }
+    if (has_level && (route->clusters & EP_CLUSTER_LEVEL) && e->level_count < SCENE_LEVELS_MAX) {
+        e->levels[e->level_count++] = (scene_level_t){ .endpoint = endpoint, .level = level };
+    }
+}
+
+// Выполнение сцены на эндпоинтах members: реле одной пачкой, диммеры - своими переходами
+static void scene_apply(const scene_entry_t *e, const relay_bits_snapshot_t *members, uint16_t transition)
+{
+    relay_bits_snapshot_t relay_mask = {0};
+
+    for (int w = 0; w < RELAY_BITS_WORDS; w++) {
+        uint32_t word = members->w[w];
+        while (word) {
+            uint8_t endpoint = w * 32 + __builtin_ctz(word);
+            const endpoint_route_t *route = endpoint_table_route(endpoint);
+            word &= word - 1;
+            if (route == NULL || !scene_has_endpoint(e, endpoint)) {
+                continue;
+            }
+
+            bool on = ep_bit(&e->set, endpoint) ||
+                      (!ep_bit(&e->clear, endpoint) && relay_bits_get(&relay_state, endpoint));
+            if (route->clusters & EP_CLUSTER_LEVEL) {
+                int i = scene_level_index(e, endpoint);
+                level_control_recall(endpoint, on, i >= 0 ? e->levels[i].level : level_control_get_on_level(endpoint),
+                                     transition);
+            } else if (ep_bit(&e->set, endpoint) || ep_bit(&e->clear, endpoint)) {
+                ep_bit_put(&relay_mask, endpoint, true);
+                esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                             ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, &on, false);
+            }
+
+            uint8_t scene_id = e->scene_id;
+            uint16_t group_id = e->group_id;
+            bool valid = true;
+            esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                         ESP_ZB_ZCL_ATTR_SCENES_CURRENT_SCENE_ID, &scene_id, false);
+            esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                         ESP_ZB_ZCL_ATTR_SCENES_CURRENT_GROUP_ID, &group_id, false);
+            esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                         ESP_ZB_ZCL_ATTR_SCENES_SCENE_VALID_ID, &valid, false);
+        }
+    }
+    if (relay_output_apply(&relay_mask, &e->set) != ESP_OK) {
+        ESP_LOGW(TAG, "Scene %d: TX queue full", e->scene_id);
+    }
+}
+
+// Поля Add Scene: [группа][сцена][время][имя - строка ZCL][{кластер, длина, данные}...]
+static void scene_add(uint8_t endpoint, const uint8_t *payload, size_t len, bool enhanced)
+{
+    if (len < 6 || len < 6 + (size_t)payload[5]) {
+        return;
+    }
+    uint16_t group_id = get_u16le(&payload[0]);
+    if (group_id && !zb_aps_is_endpoint_in_group(group_id, endpoint)) {
+        return;  // стек ответит ошибкой и сцену не добавит
+    }
+
+    bool has_on_off = false, on = false, has_level = false;
+    uint8_t level = 0;
+    size_t pos = 6 + payload[5];
+    while (pos + 3 <= len) {
+        uint16_t cluster = get_u16le(&payload[pos]);
+        uint8_t field_len = payload[pos + 2];
+        pos += 3;
+        if (pos + field_len > len) {
+            break;
+        }
+        if (cluster == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF && field_len >= 1) {
+            has_on_off = true;
+            on = payload[pos];
+        } else if (cluster == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL && field_len >= 1) {
+            has_level = true;
+            level = payload[pos];
+        }
+        pos += field_len;
+    }
+
+    scene_entry_t *e = scene_alloc(group_id, payload[2]);
+    if (e) {
+        uint16_t transition = get_u16le(&payload[3]);
+        // Add Scene задает время в секундах, Enhanced Add Scene - в 1/10 с
+        e->transition = enhanced ? transition : transition * 10;
+        scene_put_endpoint(e, endpoint, has_on_off, on, has_level, level);
+        scene_save(e);
+    }
+}
+
+bool scene_control_handle_command(bool group_delivery, uint16_t group_addr, uint16_t src_addr, uint8_t tsn,
+                                  uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    if (route == NULL || !(route->clusters & EP_CLUSTER_ON_OFF)) {
+        return false;
+    }
+
+    switch (cmd_id) {
+    case ESP_ZB_ZCL_CMD_SCENES_ADD_SCENE:
+    case ESP_ZB_ZCL_CMD_SCENES_ENHANCED_ADD_SCENE:
+        scene_add(endpoint, payload, len, cmd_id == ESP_ZB_ZCL_CMD_SCENES_ENHANCED_ADD_SCENE);
+        return false;
+
+    case ESP_ZB_ZCL_CMD_SCENES_REMOVE_SCENE: {
+        scene_entry_t *e = len >= 3 ? scene_find(get_u16le(payload), payload[2]) : NULL;
+        if (e && scene_has_endpoint(e, endpoint)) {
+            scene_remove_endpoint(e, endpoint);
+            scene_save(e);
+        }
+        return false;
+    }
+
+    case ESP_ZB_ZCL_CMD_SCENES_REMOVE_ALL_SCENES:
+        for (int i = 0; len >= 2 && i < SCENE_TABLE_SIZE; i++) {
+            scene_entry_t *e = &scenes[i];
+            if (e->used && e->group_id == get_u16le(payload) && scene_has_endpoint(e, endpoint)) {
+                scene_remove_endpoint(e, endpoint);
+                scene_save(e);
+            }
+        }
+        return false;
+
+    case ESP_ZB_ZCL_CMD_SCENES_RECALL_SCENE: {
+        if (len < 3) {
+            return false;
+        }
+        const scene_entry_t *e = scene_find(get_u16le(payload), payload[2]);
+        if (e == NULL || !scene_has_endpoint(e, endpoint)) {
+            return false;  // сцены нет в таблице - выполнит стек через колбэк
+        }
+        if (group_delivery && group_control_frame_seen(group_addr, src_addr, tsn, endpoint)) {
+            return true;
+        }
+
+        relay_bits_snapshot_t members = {0};
+        if (!group_delivery || !group_control_members(group_addr, &members)) {
+            ep_bit_put(&members, endpoint, true);
+        }
+        uint16_t transition = len >= 5 && get_u16le(&payload[3]) != 0xFFFF ? get_u16le(&payload[3]) : e->transition;
+        scene_apply(e, &members, transition);
+        if (group_delivery) {
+            group_control_frame_done(group_addr, src_addr, tsn, endpoint, &members);
+        }
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+void scene_control_store(uint8_t endpoint, uint16_t group_id, uint8_t scene_id)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    if (route == NULL || !(route->clusters & EP_CLUSTER_ON_OFF)) {
+        return;
+    }
+
+    scene_entry_t *e = scene_alloc(group_id, scene_id);
+    if (e) {
+        bool dimmer = route->clusters & EP_CLUSTER_LEVEL;
+        scene_put_endpoint(e, endpoint, true, relay_bits_get(&relay_state, endpoint),
+                           dimmer, dimmer ? level_control_get_on_level(endpoint) : 0);
+        scene_save(e);
+    }
+}
+
+void scene_control_recall_fields(uint8_t endpoint, const esp_zb_zcl_scenes_extension_field_t *fields,
+                                 uint16_t transition)
+{
+    const endpoint_route_t *route = endpoint_table_route(endpoint);
+    bool on = relay_bits_get(&relay_state, endpoint);
+    int level = -1;
+
+    if (route == NULL) {
+        return;
+    }
+    for (; fields; fields = fields->next) {
+        if (fields->length < 1) {
+            continue;
+        }
+        if (fields->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF) {
+            on = fields->extension_field_attribute_value_list[0];
+        } else if (fields->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL) {
+            level = fields->extension_field_attribute_value_list[0];
+        }
+    }
+
+    if (route->clusters & EP_CLUSTER_LEVEL) {
+        level_control_recall(endpoint, on, level >= 0 ? level : level_control_get_on_level(endpoint), transition);
+    } else {
+        relay_output_set(endpoint, on);
+        esp_zb_zcl_set_attribute_val(endpoint, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                     ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, &on, false);
+    }
+}
+
+void scene_control_clear(void)
+{
+    nvs_handle_t nvs;
+
+    memset(scenes, 0, sizeof(scenes));
+    if (nvs_open(SCENE_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_all(nvs);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+esp_err_t scene_control_init(void)
+{
+    nvs_handle_t nvs;
+    int loaded = 0;
+
+    if (nvs_open(SCENE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return ESP_OK;  // сцен еще не было
+    }
+    for (int i = 0; i < SCENE_TABLE_SIZE; i++) {
+        char key[8];
+        size_t size = sizeof(scenes[i]);
+        snprintf(key, sizeof(key), "s%d", i);
+        if (nvs_get_blob(nvs, key, &scenes[i], &size) != ESP_OK || size != sizeof(scenes[i]) ||
+            scenes[i].level_count > SCENE_LEVELS_MAX) {
+            memset(&scenes[i], 0, sizeof(scenes[i]));
+        } else if (scenes[i].used) {
+            loaded++;
+        }
+    }
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "%d scenes loaded from NVS", loaded);
+    return ESP_OK;
+}
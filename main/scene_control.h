@@ -0,0 +1,32 @@
+// scene_control.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "ha/esp_zigbee_ha_standard.h"
+
+// Сцены хранятся заранее собранными: для пары (группа, сцена) - маски
+// эндпоинтов, которые включаются и выключаются, и уровни диммеров.
+// Таблица живет в NVS и переживает перезагрузку. Вызов сцены - одна
+// пачка реле (один кадр UART) плюс команды уровня, без записи атрибутов
+// по одному. Протокол кластера Scenes (ответы, состав сцен) ведет стек.
+// Все функции вызываются из задачи Zigbee.
+esp_err_t scene_control_init(void);
+
+// Команда кластера Scenes. Add/Remove только учитываются (false - дальше
+// их обработает стек), Recall выполняется из таблицы. group_delivery - кадр
+// пришел на группу group_addr.
+bool scene_control_handle_command(bool group_delivery, uint16_t group_addr, uint16_t src_addr, uint8_t tsn,
+                                  uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len);
+
+// Store Scene от стека: текущее состояние эндпоинта попадает в сцену
+void scene_control_store(uint8_t endpoint, uint16_t group_id, uint8_t scene_id);
+
+// Recall Scene, которой нет в таблице: применяем поля сцены из стека к эндпоинту
+void scene_control_recall_fields(uint8_t endpoint, const esp_zb_zcl_scenes_extension_field_t *fields,
+                                 uint16_t transition);
+
+// Выход из сети: стек забывает сцены, мы тоже
+void scene_control_clear(void);
@@ -0,0 +1,208 @@
+// wb_protocol.c
+#include "wb_protocol.h"
+#include <string.h>
+
+// CRC-8, полином 0x07, начальное значение 0x00
+static const uint8_t crc8_table[256] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3,
+};
+
+uint8_t wb_crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        crc = crc8_table[crc ^ *data++];
+    }
+    return crc;
+}
+
+size_t wb_frame_encode(uint8_t *buf, size_t size, uint8_t type, uint8_t seq,
+                       const uint8_t *payload, uint8_t len)
+{
+    size_t total = WB_FRAME_HDR_LEN + len + WB_FRAME_CRC_LEN;
+    if (len > WB_FRAME_MAX_PAYLOAD || size < total) {
+        return 0;
+    }
+    buf[0] = WB_FRAME_SYNC;
+    buf[1] = type;
+    buf[2] = seq;
+    buf[3] = len;
+    if (len) {
+        memcpy(&buf[WB_FRAME_HDR_LEN], payload, len);
+    }
+    buf[WB_FRAME_HDR_LEN + len] = wb_crc8(&buf[1], WB_FRAME_HDR_LEN - 1 + len);
+    return total;
+}
+
+size_t wb_frame_encode_relays(uint8_t *buf, size_t size, uint8_t seq, uint64_t mask, uint64_t values)
+{
+    uint8_t payload[1 + 2 * sizeof(uint64_t)];
+
+    if (mask == 0) {
+        return 0;
+    }
+
+    // Один канал - короткий кадр
+    if ((mask & (mask - 1)) == 0) {
+        uint8_t channel = (uint8_t)__builtin_ctzll(mask);
+        payload[0] = channel | ((values & mask) ? WB_RELAY_STATE_BIT : 0);
+        return wb_frame_encode(buf, size, WB_FRAME_RELAY_SET, seq, payload, 1);
+    }
+
+    // Передаем только байты до старшего изменяемого канала
+    uint8_t n = (uint8_t)((64 - __builtin_clzll(mask) + 7) / 8);
+    payload[0] = n;
+    for (uint8_t i = 0; i < n; i++) {
+        payload[1 + i] = (uint8_t)(mask >> (8 * i));
+        payload[1 + n + i] = (uint8_t)(values >> (8 * i));
+    }
+    return wb_frame_encode(buf, size, WB_FRAME_RELAY_MASK, seq, payload, 1 + 2 * n);
+}
+
+size_t wb_frame_encode_level(uint8_t *buf, size_t size, uint8_t seq, uint8_t channel,
+                             uint8_t level, uint16_t transition)
+{
+    uint8_t payload[4] = { channel, level, transition & 0xFF, transition >> 8 };
+    return wb_frame_encode(buf, size, WB_FRAME_LEVEL_SET, seq, payload, sizeof(payload));
+}
+
+wb_parse_result_t wb_frame_parse(const uint8_t *buf, size_t len, wb_frame_t *frame, size_t *consumed)
+{
+    const uint8_t *sync = memchr(buf, WB_FRAME_SYNC, len);
+    if (sync == NULL) {
+        *consumed = len;
+        return WB_PARSE_NEED_MORE;
+    }
+
+    size_t skip = sync - buf;
+    size_t avail = len - skip;
+    *consumed = skip;
+    if (avail < WB_FRAME_HDR_LEN) {
+        return WB_PARSE_NEED_MORE;
+    }
+
+    uint8_t plen = sync[3];
+    if (plen > WB_FRAME_MAX_PAYLOAD) {
+        // Ложный SYNC внутри данных - ищем следующий
+        *consumed = skip + 1;
+        return WB_PARSE_ERROR;
+    }
+
+    size_t total = WB_FRAME_HDR_LEN + plen + WB_FRAME_CRC_LEN;
+    if (avail < total) {
+        return WB_PARSE_NEED_MORE;
+    }
+
+    if (wb_crc8(&sync[1], WB_FRAME_HDR_LEN - 1 + plen) != sync[WB_FRAME_HDR_LEN + plen]) {
+        *consumed = skip + 1;
+        return WB_PARSE_ERROR;
+    }
+
+    frame->type = sync[1];
+    frame->seq = sync[2];
+    frame->len = plen;
+    frame->payload = &sync[WB_FRAME_HDR_LEN];
+    *consumed = skip + total;
+    return WB_PARSE_OK;
+}
+
+bool wb_frame_get_relays(const wb_frame_t *frame, uint64_t *mask, uint64_t *values)
+{
+    *mask = 0;
+    *values = 0;
+
+    if (frame->type == WB_FRAME_RELAY_SET) {
+        if (frame->len != 1) {
+            return false;
+        }
+        uint8_t channel = frame->payload[0] & ~WB_RELAY_STATE_BIT;
+        if (channel >= WB_RELAY_CHANNELS_MAX) {
+            return false;
+        }
+        *mask = 1ULL << channel;
+        *values = (frame->payload[0] & WB_RELAY_STATE_BIT) ? *mask : 0;
+        return true;
+    }
+
+    if (frame->type == WB_FRAME_RELAY_MASK || frame->type == WB_FRAME_STATE) {
+        uint8_t n = frame->len ? frame->payload[0] : 0;
+        if (n == 0 || n > sizeof(uint64_t) || frame->len != 1 + 2 * n) {
+            return false;
+        }
+        for (uint8_t i = 0; i < n; i++) {
+            *mask |= (uint64_t)frame->payload[1 + i] << (8 * i);
+            *values |= (uint64_t)frame->payload[1 + n + i] << (8 * i);
+        }
+        *values &= *mask;
+        return true;
+    }
+
+    return false;
+}
+
+// Десятичная запись без ведущих нулей, возвращает конец записи
+static char *put_decimal(char *p, uint32_t value)
+{
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+size_t wb_text_encode_relay(char *buf, size_t size, uint8_t endpoint, bool state)
+{
+    if (size < WB_TEXT_CMD_MAX_LEN) {
+        return 0;
+    }
+
+    char *p = buf;
+    memcpy(p, "CMD:EP", 6);
+    p = put_decimal(p + 6, endpoint);
+    if (state) {
+        memcpy(p, ":ON\r\n", 5);
+        p += 5;
+    } else {
+        memcpy(p, ":OFF\r\n", 6);
+        p += 6;
+    }
+    return p - buf;
+}
+
+size_t wb_text_encode_level(char *buf, size_t size, uint8_t endpoint, uint8_t level, uint16_t transition)
+{
+    if (size < WB_TEXT_LEVEL_MAX_LEN) {
+        return 0;
+    }
+
+    char *p = buf;
+    memcpy(p, "CMD:EP", 6);
+    p = put_decimal(p + 6, endpoint);
+    memcpy(p, ":LEVEL:", 7);
+    p = put_decimal(p + 7, level);
+    *p++ = ':';
+    p = put_decimal(p, transition);
+    memcpy(p, "\r\n", 2);
+    return p + 2 - buf;
+}
@@ -0,0 +1,80 @@
+// wb_protocol.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Формат бинарного кадра:
+// [SYNC][TYPE][SEQ][LEN][PAYLOAD...LEN][CRC8]
+// CRC-8 (полином 0x07) считается по TYPE..PAYLOAD.
+#define WB_FRAME_SYNC           0xA5
+#define WB_FRAME_HDR_LEN        4
+#define WB_FRAME_CRC_LEN        1
+#define WB_FRAME_MAX_PAYLOAD    32
+#define WB_FRAME_MAX_LEN        (WB_FRAME_HDR_LEN + WB_FRAME_MAX_PAYLOAD + WB_FRAME_CRC_LEN)
+
+// Реле адресуются номером канала: канал 0 = первый эндпоинт, и т.д.
+#define WB_RELAY_CHANNELS_MAX   64
+#define WB_RELAY_STATE_BIT      0x80
+
+// Максимальная длина текстовой команды "CMD:EP255:OFF\r\n"
+#define WB_TEXT_CMD_MAX_LEN     16
+// и команды уровня "CMD:EP255:LEVEL:254:65535\r\n"
+#define WB_TEXT_LEVEL_MAX_LEN   28
+
+typedef enum {
+    WB_FRAME_RELAY_SET  = 0x01,  // payload: [channel | WB_RELAY_STATE_BIT]
+    WB_FRAME_RELAY_MASK = 0x02,  // payload: [n][mask n байт LE][values n байт LE]
+    WB_FRAME_STATE      = 0x03,  // от Wiren Board: фактическое состояние реле, payload как у RELAY_MASK
+    WB_FRAME_LEVEL_SET  = 0x04,  // payload: [channel][уровень 0..254][время перехода uint16 LE, 1/10 с]
+    WB_FRAME_BAUD_REQ   = 0x10,  // payload: [скорость uint32 LE], seq = 0
+    WB_FRAME_BAUD_ACK   = 0x11,  // payload: та же скорость, если поддерживается
+    WB_FRAME_BAUD_TEST  = 0x12,  // тестовая последовательность на новой скорости, эхо в ответ
+    WB_FRAME_PING       = 0x20,  // контроль связи, без payload, seq = 0
+    WB_FRAME_PONG       = 0x21,  // ответ на PING
+    WB_FRAME_ACK        = 0x80,  // seq = номер подтверждаемого кадра, без payload
+    WB_FRAME_NAK        = 0x81,  // seq = номер кадра, который нужно повторить
+} wb_frame_type_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t seq;
+    uint8_t len;
+    const uint8_t *payload;  // указывает внутрь входного буфера, без копирования
+} wb_frame_t;
+
+typedef enum {
+    WB_PARSE_OK,         // кадр найден, frame заполнен
+    WB_PARSE_NEED_MORE,  // нужно больше данных
+    WB_PARSE_ERROR,      // битый кадр (CRC/длина), парсер сдвинулся на следующий байт
+} wb_parse_result_t;
+
+uint8_t wb_crc8(const uint8_t *data, size_t len);
+
+// Кодирование кадра в buf. Возвращает длину кадра или 0, если не помещается.
+size_t wb_frame_encode(uint8_t *buf, size_t size, uint8_t type, uint8_t seq,
+                       const uint8_t *payload, uint8_t len);
+
+// Команда для набора реле: mask - какие каналы меняются, values - их новое состояние.
+// Для одного канала выбирается короткий кадр WB_FRAME_RELAY_SET.
+size_t wb_frame_encode_relays(uint8_t *buf, size_t size, uint8_t seq, uint64_t mask, uint64_t values);
+
+// Переход диммера к level за transition десятых секунды. Сам переход
+// ведет Wiren Board, промежуточные уровни по линии не передаются.
+size_t wb_frame_encode_level(uint8_t *buf, size_t size, uint8_t seq, uint8_t channel,
+                             uint8_t level, uint16_t transition);
+
+// Разбор кадра из начала buf. consumed - сколько байт можно отбросить
+// (мусор до SYNC, битый кадр или целый кадр). Данные frame->payload
+// валидны, пока buf не перезаписан.
+wb_parse_result_t wb_frame_parse(const uint8_t *buf, size_t len, wb_frame_t *frame, size_t *consumed);
+
+// Разбор payload кадров с реле (RELAY_SET, RELAY_MASK, STATE) в mask/values.
+bool wb_frame_get_relays(const wb_frame_t *frame, uint64_t *mask, uint64_t *values);
+
+// Текстовый режим совместимости: "CMD:EP<endpoint>:ON\r\n" / "CMD:EP<endpoint>:OFF\r\n"
+size_t wb_text_encode_relay(char *buf, size_t size, uint8_t endpoint, bool state);
+
+// "CMD:EP<endpoint>:LEVEL:<уровень>:<время перехода, 1/10 с>\r\n"
+size_t wb_text_encode_level(char *buf, size_t size, uint8_t endpoint, uint8_t level, uint16_t transition);
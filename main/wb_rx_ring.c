@@ -0,0 +1,56 @@
+// wb_rx_ring.c
+#include "wb_rx_ring.h"
+#include <string.h>
+
+#define RING_MASK  (WB_RX_RING_SIZE - 1)
+
+_Static_assert((WB_RX_RING_SIZE & RING_MASK) == 0, "WB_RX_RING_SIZE must be a power of two");
+
+void wb_rx_ring_reset(wb_rx_ring_t *ring)
+{
+    ring->rd = 0;
+    ring->wr = 0;
+}
+
+uint8_t *wb_rx_ring_write_ptr(wb_rx_ring_t *ring, size_t *space)
+{
+    uint32_t off = ring->wr & RING_MASK;
+    size_t free_total = WB_RX_RING_SIZE - (ring->wr - ring->rd);
+    size_t to_end = WB_RX_RING_SIZE - off;
+
+    *space = free_total < to_end ? free_total : to_end;
+    return &ring->buf[off];
+}
+
+void wb_rx_ring_commit(wb_rx_ring_t *ring, size_t len)
+{
+    uint32_t off = ring->wr & RING_MASK;
+
+    // Обновляем копию начала кольца за его концом
+    if (off < WB_FRAME_MAX_LEN) {
+        size_t n = WB_FRAME_MAX_LEN - off < len ? WB_FRAME_MAX_LEN - off : len;
+        memcpy(&ring->buf[WB_RX_RING_SIZE + off], &ring->buf[off], n);
+    }
+    ring->wr += len;
+}
+
+wb_parse_result_t wb_rx_ring_next_frame(wb_rx_ring_t *ring, wb_frame_t *frame)
+{
+    for (;;) {
+        uint32_t off = ring->rd & RING_MASK;
+        size_t avail = ring->wr - ring->rd;
+        size_t view = WB_RX_RING_SIZE - off + WB_FRAME_MAX_LEN;
+        size_t consumed;
+
+        if (avail == 0) {
+            return WB_PARSE_NEED_MORE;
+        }
+        wb_parse_result_t res = wb_frame_parse(&ring->buf[off], avail < view ? avail : view, frame, &consumed);
+        ring->rd += consumed;
+        // После пропуска мусора начало кадра могло оказаться в копии за концом
+        // кольца, где вид короче кадра: разбираем еще раз от перенесенного rd
+        if (res != WB_PARSE_NEED_MORE || consumed == 0) {
+            return res;
+        }
+    }
+}
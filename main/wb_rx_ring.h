@@ -0,0 +1,27 @@
+// wb_rx_ring.h
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wb_protocol.h"
+
+#define WB_RX_RING_SIZE  512  // степень двойки
+
+// Приемное кольцо с разбором кадров на месте. За концом кольца лежит
+// копия первых WB_FRAME_MAX_LEN байт, поэтому кадр, переходящий через
+// границу, все равно виден одним непрерывным куском и отдается без копирования.
+typedef struct {
+    uint32_t rd;  // счетчики без маски: занято wr - rd байт
+    uint32_t wr;
+    uint8_t buf[WB_RX_RING_SIZE + WB_FRAME_MAX_LEN];
+} wb_rx_ring_t;
+
+void wb_rx_ring_reset(wb_rx_ring_t *ring);
+
+// Непрерывное свободное место для записи из UART
+uint8_t *wb_rx_ring_write_ptr(wb_rx_ring_t *ring, size_t *space);
+void wb_rx_ring_commit(wb_rx_ring_t *ring, size_t len);
+
+// Следующий кадр из кольца. При WB_PARSE_OK frame->payload указывает
+// внутрь кольца и валиден до следующего вызова wb_rx_ring_write_ptr/commit.
+wb_parse_result_t wb_rx_ring_next_frame(wb_rx_ring_t *ring, wb_frame_t *frame);
@@ -0,0 +1,1586 @@
+// wb_uart.c
+#include "wb_uart.h"
+#include "wb_protocol.h"
+#include "wb_window.h"
+#include "wb_rx_ring.h"
+#include "modbus_slave.h"
+#include <string.h>
+#include "endpoint_table.h"
+#include "relay_state.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_bit_defs.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "WB_UART";
+
+// UART конфигурации для передачи через реальные выводы
+#define UART_PORT_NUM      UART_NUM_1   // UART0 - порт ROM-загрузчика, консоль на USB Serial/JTAG
+#define UART_BAUD_RATE     115200
+#define UART_BUF_SIZE      256
+#define UART_QUEUE_SIZE    20
+#define UART_TX_PIN        GPIO_NUM_16  // Выберите подходящие GPIO для вашей платы
+#define UART_RX_PIN        GPIO_NUM_17  // Выберите подходящие GPIO для вашей платы
+#if CONFIG_WB_UART_RS485
+#define UART_RTS_PIN       CONFIG_WB_UART_RS485_DE_GPIO  // DE/RE трансивера RS-485
+#else
+#define UART_RTS_PIN       UART_PIN_NO_CHANGE
+#endif
+#define WB_RX_TIMEOUT_SYMBOLS  2  // пауза в символах, после которой приходит UART_DATA
+#define MB_RX_TIMEOUT_SYMBOLS_MAX  126  // предел аппаратного таймаута приема
+
+#define WB_TX_QUEUE_DEPTH  CONFIG_WB_TX_QUEUE_DEPTH
+#define WB_TX_TASK_PRIO    6  // выше Zigbee_main, чтобы очередь разбиралась сразу
+
+// Окно объединения команд в один кадр
+#define WB_TX_COALESCE_WINDOW_US  CONFIG_WB_TX_COALESCE_WINDOW_US
+#define WB_TX_COALESCE_MAX_CMDS   CONFIG_WB_TX_COALESCE_MAX_CMDS
+
+// Биты уведомления задачи отправки
+#define TX_NOTIFY_CMD      BIT0  // в очереди новая команда
+#define TX_NOTIFY_WINDOW   BIT1  // окно объединения истекло
+#define TX_NOTIFY_LINK     BIT2  // ACK/NAK или таймер повтора
+#define TX_NOTIFY_BAUD     BIT3  // ответ на запрос смены скорости
+#define TX_NOTIFY_BAUD_DOWN BIT4 // много ошибок приема, понизить скорость
+#define TX_NOTIFY_RESYNC   BIT5  // пора повторить известное состояние всех реле
+#define TX_NOTIFY_HEALTH   BIT6  // пора проверить связь с Wiren Board
+
+// Связь отслеживается по принятым кадрам; в текстовом режиме Wiren Board не отвечает
+#define WB_LINK_TRACKING   (CONFIG_WB_LINK_TIMEOUT_MS > 0)
+// Повтор состояния всех каналов: по таймеру и после восстановления связи
+#define WB_TX_RESYNC       (CONFIG_WB_TX_RESYNC_INTERVAL_S > 0 || (WB_LINK_TRACKING && !CONFIG_WB_PROTOCOL_MODBUS))
+
+// Согласование скорости: запрос и тестовый кадр ждут ответа столько
+#define WB_BAUD_REPLY_TIMEOUT_MS  100
+// Столько Wiren Board ждет тестовый кадр на новой скорости, прежде чем вернуться
+#define WB_BAUD_REVERT_MS         250
+// Без единого целого кадра столько Wiren Board сам возвращается на базовую скорость
+#define WB_BAUD_SILENCE_REVERT_MS 2000
+// Ожидание конца передачи для проверки коллизии RS-485
+#define WB_RS485_TX_DONE_TIMEOUT_MS  20
+
+_Static_assert((WB_TX_QUEUE_DEPTH & (WB_TX_QUEUE_DEPTH - 1)) == 0,
+               "CONFIG_WB_TX_QUEUE_DEPTH must be a power of two");
+
+// Запись очереди отправки фиксированного размера
+typedef struct {
+    uint8_t channel;
+    uint8_t state;
+    uint8_t level;        // WB_TX_LEVEL_NONE - команда реле, иначе уровень диммера
+    uint8_t batch_more;   // следующая запись из той же пачки wb_uart_send_relays()
+    uint16_t transition;  // время перехода диммера, 1/10 с
+    uint32_t enq_us;      // постановка в очередь, младшие 32 бита esp_timer
+} wb_tx_cmd_t;
+#define WB_TX_LEVEL_NONE  0xFF
+
+// Кольцо single-producer/single-consumer без блокировок:
+// пишет только Zigbee-задача (head), читает только задача отправки (tail).
+static wb_tx_cmd_t tx_ring[WB_TX_QUEUE_DEPTH];
+static uint32_t tx_head;
+static uint32_t tx_tail;
+static uint32_t baud_current = UART_BAUD_RATE;
+
+static wb_uart_tx_stats_t tx_stats;
+static wb_uart_rx_stats_t rx_stats;
+// Задержка команды: от постановки в очередь (задача Zigbee, сразу после
+// приема команды) до подтверждения кадра Wiren Board, без подтверждений -
+// до записи в UART (в Modbus - до обновления катушек для мастера).
+static uint32_t tx_frame_origin_us;  // самая старая команда отправляемого кадра
+static bool tx_frame_timed;          // false - кадр не из очереди (повтор состояния)
+#if CONFIG_WB_TX_ACK
+static struct {
+    uint32_t origin_us;
+    bool timed;
+} tx_origin[CONFIG_WB_TX_WINDOW_SIZE];  // по номеру кадра, как слоты окна
+#endif
+#if CONFIG_WB_PROTOCOL_MODBUS
+// Кадр RTU копится линейно до паузы в 3.5 символа
+static uint8_t mb_rx_buf[MODBUS_ADU_MAX];
+static size_t mb_rx_len;
+static bool mb_rx_overrun;
+static esp_timer_handle_t mb_t35_timer;
+static SemaphoreHandle_t mb_t35_sem;   // таймер t3.5 сработал
+static QueueSetHandle_t mb_rx_set;     // задача приема ждет события UART или таймер
+static int64_t mb_rx_last_us;   // оценка прихода последнего байта кадра на линию
+static uint32_t mb_hw_gap_us;   // пауза, которую отмеряет аппаратный таймаут приема
+static wb_uart_modbus_timing_t mb_timing;
+#else
+static wb_rx_ring_t rx_ring;
+#endif
+static wb_uart_state_cb_t state_handler;
+static QueueHandle_t uart_queue;
+static TaskHandle_t tx_task_handle;
+static esp_timer_handle_t coalesce_timer;
+#if CONFIG_WB_TX_ACK
+static esp_timer_handle_t retx_timer;
+#endif
+#if CONFIG_WB_TX_RESYNC_INTERVAL_S
+static esp_timer_handle_t resync_timer;
+#endif
+#if WB_TX_RESYNC
+static bool resync_pending;  // только задача отправки
+#endif
+#if WB_LINK_TRACKING
+// Состояние связи меняет только задача отправки
+static esp_timer_handle_t link_timer;
+static wb_uart_link_cb_t link_handler;
+static bool link_up;
+static uint32_t link_rx_seen;   // счетчик принятых кадров на прошлой проверке
+static uint32_t link_rx_ms;     // когда он менялся последний раз
+#if WB_TX_RESYNC
+static bool link_up_pending;    // связь есть, но состояние еще не повторено
+#if CONFIG_WB_TX_ACK
+static uint8_t link_resync_seq;  // кадр повтора состояния после восстановления связи
+static bool link_resync_wait;    // его ACK еще не пришел, сбрасывает задача приема
+#endif
+#endif
+#if CONFIG_WB_TX_ACK
+static uint32_t link_failed_seen;
+#endif
+#endif
+
+// Состояние каналов на стороне Wiren Board. Пишут задача отправки и задача
+// приема (отчеты STATE, ACK). Слова 0-1 - состояние каналов 0..63, слова 2-3 -
+// каналы, чье состояние Wiren Board принял, слова 4-5 - каналы, отправленные
+// без подтверждения: они уходят со следующим повтором состояния.
+static relay_bits_t shadow = RELAY_BITS_INITIALIZER;
+#define SHADOW_VALUES_WORD   0
+#define SHADOW_KNOWN_WORD    2
+#define SHADOW_PENDING_WORD  4
+#if CONFIG_WB_TX_ACK
+// Каналы кадра в пути, по номеру кадра. Канал из более нового кадра
+// убирается из старых, чтобы их ACK не вернул устаревшее значение.
+static struct {
+    uint64_t mask;
+    uint64_t values;
+} tx_inflight[CONFIG_WB_TX_WINDOW_SIZE];
+static portMUX_TYPE tx_inflight_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+#if CONFIG_WB_PROTOCOL_BINARY
+static uint8_t wb_tx_seq;
+#endif
+
+static bool tx_ring_push(const wb_tx_cmd_t *cmd)
+{
+    uint32_t head = tx_head;
+    uint32_t tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+    uint32_t used = head - tail;
+
+    if (used >= WB_TX_QUEUE_DEPTH) {
+        return false;
+    }
+    tx_ring[head & (WB_TX_QUEUE_DEPTH - 1)] = *cmd;
+    __atomic_store_n(&tx_head, head + 1, __ATOMIC_RELEASE);
+
+    if (used + 1 > tx_stats.high_water) {
+        tx_stats.high_water = used + 1;
+    }
+    return true;
+}
+
+// Пачка команд реле публикуется одним сдвигом head: задача отправки видит
+// ее целиком или не видит совсем
+static bool tx_ring_push_relays(uint64_t mask, uint64_t values)
+{
+    uint32_t head = tx_head;
+    uint32_t tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+    uint32_t used = head - tail;
+    uint32_t n = __builtin_popcountll(mask);
+    uint32_t now = esp_timer_get_time();
+
+    if (used + n > WB_TX_QUEUE_DEPTH) {
+        return false;
+    }
+    while (mask) {
+        uint8_t channel = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        tx_ring[head++ & (WB_TX_QUEUE_DEPTH - 1)] = (wb_tx_cmd_t){
+            .channel = channel,
+            .state = (values >> channel) & 1,
+            .level = WB_TX_LEVEL_NONE,
+            .batch_more = mask != 0,
+            .enq_us = now,
+        };
+    }
+    __atomic_store_n(&tx_head, head, __ATOMIC_RELEASE);
+
+    if (used + n > tx_stats.high_water) {
+        tx_stats.high_water = used + n;
+    }
+    return true;
+}
+
+// Голова очереди без извлечения, NULL - очередь пуста
+static const wb_tx_cmd_t *tx_ring_peek(void)
+{
+    uint32_t head = __atomic_load_n(&tx_head, __ATOMIC_ACQUIRE);
+
+    if (head == tx_tail) {
+        return NULL;
+    }
+    return &tx_ring[tx_tail & (WB_TX_QUEUE_DEPTH - 1)];
+}
+
+static void tx_ring_advance(void)
+{
+    __atomic_store_n(&tx_tail, tx_tail + 1, __ATOMIC_RELEASE);
+}
+
+// Запись в UART. В режиме RS-485 направление трансивера переключает сам UART
+// по RTS; после передачи проверяем, не было ли коллизии на шине.
+static bool uart_send(const void *data, size_t len)
+{
+    if (uart_write_bytes(UART_PORT_NUM, data, len) != (int)len) {
+        return false;
+    }
+#if CONFIG_WB_UART_RS485
+    bool collision = false;
+    if (uart_wait_tx_done(UART_PORT_NUM, pdMS_TO_TICKS(WB_RS485_TX_DONE_TIMEOUT_MS)) == ESP_OK &&
+        uart_get_collision_flag(UART_PORT_NUM, &collision) == ESP_OK && collision) {
+        __atomic_fetch_add(&tx_stats.collisions, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void tx_latency_record(uint32_t latency_us)
+{
+    if (tx_stats.latency_samples == 0) {
+        tx_stats.latency_avg_us = latency_us;
+    }
+    tx_stats.latency_avg_us += ((int32_t)latency_us - (int32_t)tx_stats.latency_avg_us) / 8;
+    if (latency_us > tx_stats.latency_max_us) {
+        tx_stats.latency_max_us = latency_us;
+    }
+    __atomic_fetch_add(&tx_stats.latency_samples, 1, __ATOMIC_RELAXED);
+}
+
+// Начало отправки кадра seq, до записи в UART: с подтверждениями задержка
+// досчитывается по ACK в задаче приема, без них - считается сразу
+static void tx_latency_frame(uint8_t seq)
+{
+#if CONFIG_WB_TX_ACK
+    tx_origin[seq & (CONFIG_WB_TX_WINDOW_SIZE - 1)].origin_us = tx_frame_origin_us;
+    __atomic_store_n(&tx_origin[seq & (CONFIG_WB_TX_WINDOW_SIZE - 1)].timed, tx_frame_timed, __ATOMIC_RELEASE);
+#else
+    if (tx_frame_timed) {
+        tx_latency_record((uint32_t)esp_timer_get_time() - tx_frame_origin_us);
+    }
+#endif
+    tx_frame_timed = false;
+}
+
+#if CONFIG_WB_TX_ACK
+static void tx_latency_acked(uint8_t seq, int64_t now_us)
+{
+    uint8_t slot = seq & (CONFIG_WB_TX_WINDOW_SIZE - 1);
+    if (__atomic_exchange_n(&tx_origin[slot].timed, false, __ATOMIC_ACQUIRE)) {
+        tx_latency_record((uint32_t)now_us - tx_origin[slot].origin_us);
+    }
+}
+#endif
+
+// Убираем из набора каналы, которые уже в нужном состоянии
+static uint64_t shadow_filter(uint64_t mask, uint64_t values)
+{
+    relay_bits_snapshot_t snap;
+    relay_bits_snapshot(&shadow, &snap);
+    uint64_t same = relay_bits_get64(&snap, SHADOW_KNOWN_WORD) &
+                    ~(values ^ relay_bits_get64(&snap, SHADOW_VALUES_WORD));
+
+    uint64_t suppressed = mask & same;
+    if (suppressed) {
+        __atomic_fetch_add(&tx_stats.suppressed, __builtin_popcountll(suppressed), __ATOMIC_RELAXED);
+    }
+    return mask & ~same;
+}
+
+// Wiren Board принял состояние каналов mask
+static void shadow_update(uint64_t mask, uint64_t values)
+{
+    relay_bits_snapshot_t m = {0}, v = {0};
+    relay_bits_put64(&m, SHADOW_VALUES_WORD, mask);
+    relay_bits_put64(&v, SHADOW_VALUES_WORD, values);
+    relay_bits_put64(&m, SHADOW_KNOWN_WORD, mask);
+    relay_bits_put64(&v, SHADOW_KNOWN_WORD, mask);
+    relay_bits_put64(&m, SHADOW_PENDING_WORD, mask);
+    relay_bits_apply(&shadow, &m, &v);
+}
+
+#if !CONFIG_WB_PROTOCOL_MODBUS
+// Состояние каналов mask ушло, но не подтверждено (или не ушло вовсе):
+// повторная команда не подавляется, канал войдет в повтор состояния
+static void shadow_pending(uint64_t mask, uint64_t values)
+{
+    relay_bits_snapshot_t m = {0}, v = {0};
+    relay_bits_put64(&m, SHADOW_VALUES_WORD, mask);
+    relay_bits_put64(&v, SHADOW_VALUES_WORD, values);
+    relay_bits_put64(&m, SHADOW_KNOWN_WORD, mask);
+    relay_bits_put64(&m, SHADOW_PENDING_WORD, mask);
+    relay_bits_put64(&v, SHADOW_PENDING_WORD, mask);
+    relay_bits_apply(&shadow, &m, &v);
+}
+#endif
+
+#if CONFIG_WB_TX_ACK
+// Кадр seq уходит: каналы ждут ACK. Вызывается до записи в UART, чтобы
+// ACK не обогнал запись о кадре.
+static void shadow_frame_sent(uint8_t seq, uint64_t mask, uint64_t values)
+{
+    portENTER_CRITICAL(&tx_inflight_lock);
+    for (int i = 0; i < CONFIG_WB_TX_WINDOW_SIZE; i++) {
+        tx_inflight[i].mask &= ~mask;
+    }
+    tx_inflight[seq & (CONFIG_WB_TX_WINDOW_SIZE - 1)].mask = mask;
+    tx_inflight[seq & (CONFIG_WB_TX_WINDOW_SIZE - 1)].values = values;
+    if (mask) {
+        shadow_pending(mask, values);
+    }
+    portEXIT_CRITICAL(&tx_inflight_lock);
+}
+
+// ACK кадра seq: его каналы, не перекрытые более новыми кадрами, приняты.
+// Отброшенный после всех повторов кадр ACK не получит, его каналы
+// остаются неизвестными и уйдут повтором состояния.
+static void shadow_frame_acked(uint8_t seq)
+{
+    uint8_t slot = seq & (CONFIG_WB_TX_WINDOW_SIZE - 1);
+
+    portENTER_CRITICAL(&tx_inflight_lock);
+    if (tx_inflight[slot].mask) {
+        shadow_update(tx_inflight[slot].mask, tx_inflight[slot].values);
+        tx_inflight[slot].mask = 0;
+    }
+    portEXIT_CRITICAL(&tx_inflight_lock);
+}
+#endif
+
+#if CONFIG_WB_PROTOCOL_BINARY
+// Отчет Wiren Board о реле. Каналы с кадром в пути не трогаем: отчет мог
+// уйти раньше, чем Wiren Board принял кадр.
+static void shadow_reported(uint64_t mask, uint64_t values)
+{
+#if CONFIG_WB_TX_ACK
+    portENTER_CRITICAL(&tx_inflight_lock);
+    for (int i = 0; i < CONFIG_WB_TX_WINDOW_SIZE; i++) {
+        mask &= ~tx_inflight[i].mask;
+    }
+    shadow_update(mask, values);
+    portEXIT_CRITICAL(&tx_inflight_lock);
+#else
+    shadow_update(mask, values);
+#endif
+}
+#endif
+
+// Отправка накопленного набора реле: один кадр в бинарном режиме,
+// по строке на канал в текстовом. В режиме Modbus обновляются катушки,
+// мастер заберет их следующим опросом.
+static void send_relays_to_wirenboard(uint64_t mask, uint64_t values)
+{
+#if CONFIG_WB_PROTOCOL_MODBUS
+    tx_latency_frame(0);
+    modbus_slave_set_coils(mask, values);
+    shadow_update(mask, values);
+    __atomic_fetch_add(&tx_stats.frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tx_stats.sent, __builtin_popcountll(mask), __ATOMIC_RELAXED);
+#elif CONFIG_WB_PROTOCOL_BINARY
+    uint8_t frame[WB_FRAME_MAX_LEN];
+    uint8_t seq = wb_tx_seq++;
+    size_t len = wb_frame_encode_relays(frame, sizeof(frame), seq, mask, values);
+    tx_latency_frame(seq);
+#if CONFIG_WB_TX_ACK
+    shadow_frame_sent(seq, mask, values);
+#endif
+    bool sent = uart_send(frame, len);
+    if (sent) {
+        __atomic_fetch_add(&tx_stats.frames, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&tx_stats.sent, __builtin_popcountll(mask), __ATOMIC_RELAXED);
+    }
+#if CONFIG_WB_TX_ACK
+    // Даже если запись не удалась, кадр уйдет повтором по таймеру
+    wb_window_push(seq, frame, len, esp_timer_get_time());
+#else
+    if (sent) {
+        shadow_update(mask, values);
+    } else {
+        shadow_pending(mask, values);
+    }
+#endif
+#else
+    char command[WB_TEXT_CMD_MAX_LEN];
+    tx_latency_frame(0);
+    while (mask) {
+        uint8_t channel = __builtin_ctzll(mask);
+        uint64_t bit = 1ULL << channel;
+        size_t len = wb_text_encode_relay(command, sizeof(command), endpoint_table_uart_endpoint(channel), values & bit);
+        if (uart_send(command, len)) {
+            __atomic_fetch_add(&tx_stats.frames, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&tx_stats.sent, 1, __ATOMIC_RELAXED);
+            shadow_update(bit, values);
+        } else {
+            shadow_pending(bit, values);
+        }
+        mask &= ~bit;
+    }
+#endif
+}
+
+// Кадр диммера: целевой уровень и время перехода, промежуточные шаги
+// считает Wiren Board (в Modbus - регистры уровня для мастера)
+static void send_level_to_wirenboard(uint8_t channel, uint8_t level, uint16_t transition)
+{
+#if CONFIG_WB_PROTOCOL_MODBUS
+    tx_latency_frame(0);
+    modbus_slave_set_level(channel, level, transition);
+    __atomic_fetch_add(&tx_stats.frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tx_stats.sent, 1, __ATOMIC_RELAXED);
+#elif CONFIG_WB_PROTOCOL_BINARY
+    uint8_t frame[WB_FRAME_MAX_LEN];
+    uint8_t seq = wb_tx_seq++;
+    size_t len = wb_frame_encode_level(frame, sizeof(frame), seq, channel, level, transition);
+    tx_latency_frame(seq);
+#if CONFIG_WB_TX_ACK
+    shadow_frame_sent(seq, 0, 0);
+#endif
+    if (uart_send(frame, len)) {
+        __atomic_fetch_add(&tx_stats.frames, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&tx_stats.sent, 1, __ATOMIC_RELAXED);
+    }
+#if CONFIG_WB_TX_ACK
+    wb_window_push(seq, frame, len, esp_timer_get_time());
+#endif
+#else
+    char command[WB_TEXT_LEVEL_MAX_LEN];
+    tx_latency_frame(0);
+    size_t len = wb_text_encode_level(command, sizeof(command), endpoint_table_uart_endpoint(channel),
+                                      level, transition);
+    if (uart_send(command, len)) {
+        __atomic_fetch_add(&tx_stats.frames, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&tx_stats.sent, 1, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+// Забираем команды реле из очереди в общий набор, последняя команда на канал
+// побеждает. Команда уровня останавливает сбор, чтобы не обогнать реле перед ней.
+// Пачка wb_uart_send_relays() забирается целиком, даже сверх limit.
+static uint32_t tx_collect(uint64_t *mask, uint64_t *values, uint32_t limit)
+{
+    const wb_tx_cmd_t *cmd;
+    uint32_t count = 0;
+    bool in_batch = false;
+
+    while ((count < limit || in_batch) && (cmd = tx_ring_peek()) != NULL && cmd->level == WB_TX_LEVEL_NONE) {
+        uint64_t bit = 1ULL << cmd->channel;
+        if (*mask == 0) {
+            tx_frame_origin_us = cmd->enq_us;
+        }
+        *mask |= bit;
+        *values = cmd->state ? (*values | bit) : (*values & ~bit);
+        in_batch = cmd->batch_more;
+        tx_ring_advance();
+        count++;
+    }
+    return count;
+}
+
+#if CONFIG_WB_TX_RESYNC_INTERVAL_S
+static void resync_timer_cb(void *arg)
+{
+    xTaskNotify(tx_task_handle, TX_NOTIFY_RESYNC, eSetBits);
+}
+#endif
+
+#if WB_TX_RESYNC
+// Повтор всего известного состояния одним кадром: исправляет расхождение,
+// если команда потерялась или реле переключили на стороне Wiren Board
+static void tx_resync(void)
+{
+    relay_bits_snapshot_t snap;
+    relay_bits_snapshot(&shadow, &snap);
+    uint64_t mask = relay_bits_get64(&snap, SHADOW_KNOWN_WORD) | relay_bits_get64(&snap, SHADOW_PENDING_WORD);
+    uint64_t values = relay_bits_get64(&snap, SHADOW_VALUES_WORD);
+
+    if (mask) {
+#if WB_LINK_TRACKING && CONFIG_WB_TX_ACK
+        // Номер запоминается до записи: ACK может прийти раньше, чем она вернется
+        if (link_up_pending) {
+            link_resync_seq = wb_tx_seq;
+            __atomic_store_n(&link_resync_wait, true, __ATOMIC_RELEASE);
+        }
+#endif
+        send_relays_to_wirenboard(mask, values);
+        __atomic_fetch_add(&tx_stats.resyncs, 1, __ATOMIC_RELAXED);
+    }
+}
+#endif
+
+static void coalesce_timer_cb(void *arg)
+{
+    xTaskNotify(tx_task_handle, TX_NOTIFY_WINDOW, eSetBits);
+}
+
+#if CONFIG_WB_TX_ACK
+static void retx_timer_cb(void *arg)
+{
+    xTaskNotify(tx_task_handle, TX_NOTIFY_LINK, eSetBits);
+}
+
+static void uart_write_frame(const uint8_t *frame, size_t len)
+{
+    uart_send(frame, len);
+}
+#endif
+
+// Повтор неподтвержденных кадров и перезапуск таймера на ближайший таймаут
+static void tx_service_window(void)
+{
+#if CONFIG_WB_TX_ACK
+    int64_t next = wb_window_service(esp_timer_get_time(), uart_write_frame);
+    esp_timer_stop(retx_timer);
+    if (next) {
+        int64_t delay = next - esp_timer_get_time();
+        esp_timer_start_once(retx_timer, delay > 0 ? delay : 1);
+    }
+#endif
+}
+
+// Можно ли отправить новый кадр: при подтверждаемой доставке нужен свободный слот окна
+static inline bool tx_can_send(void)
+{
+#if CONFIG_WB_TX_ACK
+    return wb_window_has_room(wb_tx_seq);
+#else
+    return true;
+#endif
+}
+
+// Команды уровня из головы очереди - каждая своим кадром, пока есть место в окне
+static void tx_send_levels(void)
+{
+    const wb_tx_cmd_t *cmd;
+
+    while (tx_can_send() && (cmd = tx_ring_peek()) != NULL && cmd->level != WB_TX_LEVEL_NONE) {
+        tx_frame_origin_us = cmd->enq_us;
+        tx_frame_timed = true;
+        send_level_to_wirenboard(cmd->channel, cmd->level, cmd->transition);
+        tx_ring_advance();
+        tx_service_window();
+    }
+}
+
+#if WB_LINK_TRACKING
+static void link_timer_cb(void *arg)
+{
+    xTaskNotify(tx_task_handle, TX_NOTIFY_HEALTH, eSetBits);
+}
+
+// Признак жизни Wiren Board: в Modbus - запросы с нашим адресом, иначе любой корректный кадр
+static uint32_t link_rx_frames(void)
+{
+#if CONFIG_WB_PROTOCOL_MODBUS
+    modbus_slave_stats_t stats;
+    modbus_slave_get_stats(&stats);
+    return stats.frames;
+#else
+    return __atomic_load_n(&rx_stats.frames, __ATOMIC_RELAXED);
+#endif
+}
+
+static void link_set(bool up)
+{
+    __atomic_store_n(&link_up, up, __ATOMIC_RELAXED);
+    ESP_LOGW(TAG, "Wiren Board link %s", up ? "restored" : "lost");
+    if (!up) {
+        __atomic_fetch_add(&tx_stats.link_losses, 1, __ATOMIC_RELAXED);
+    }
+#if WB_TX_RESYNC
+    // Реле отдаем Wiren Board только после повтора состояния, см. link_resynced()
+    link_up_pending = up;
+#if CONFIG_WB_TX_ACK
+    __atomic_store_n(&link_resync_wait, false, __ATOMIC_RELAXED);
+#endif
+    if (up) {
+        resync_pending = true;
+        return;
+    }
+#endif
+    if (link_handler) {
+        link_handler(up);
+    }
+}
+
+#if WB_TX_RESYNC
+// Состояние повторено: с подтверждениями - когда пришел ACK кадра повтора
+static void link_resynced(void)
+{
+#if CONFIG_WB_TX_ACK
+    if (__atomic_load_n(&link_resync_wait, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+#endif
+    if (link_up_pending) {
+        link_up_pending = false;
+        if (link_handler) {
+            link_handler(true);
+        }
+    }
+}
+#endif
+
+// Проверка раз в CONFIG_WB_LINK_HEARTBEAT_MS: точность отметки о последнем
+// кадре - один период, таймаут заведомо длиннее
+static void link_check(void)
+{
+    uint32_t now = esp_timer_get_time() / 1000;
+    uint32_t frames = link_rx_frames();
+    bool fresh = frames != link_rx_seen;
+    bool lost = false;
+
+    if (fresh) {
+        link_rx_seen = frames;
+        link_rx_ms = now;
+    } else if (now - link_rx_ms >= CONFIG_WB_LINK_TIMEOUT_MS) {
+        lost = true;
+    }
+#if CONFIG_WB_TX_ACK
+    // Кадр не подтвержден за все попытки, и с тех пор Wiren Board молчит
+    wb_window_stats_t window;
+    wb_window_get_stats(&window);
+    if (window.failed != link_failed_seen) {
+        link_failed_seen = window.failed;
+        lost |= !fresh;
+#if WB_TX_RESYNC
+        // Кадр повтора мог быть среди отброшенных - повторяем состояние еще раз
+        if (__atomic_load_n(&link_resync_wait, __ATOMIC_ACQUIRE)) {
+            resync_pending = true;
+        }
+#endif
+    }
+#endif
+#if CONFIG_WB_PROTOCOL_BINARY
+    if (!fresh) {
+        uint8_t frame[WB_FRAME_HDR_LEN + WB_FRAME_CRC_LEN];
+        size_t len = wb_frame_encode(frame, sizeof(frame), WB_FRAME_PING, 0, NULL, 0);
+        uart_send(frame, len);
+    }
+#endif
+
+    if (link_up && lost) {
+        link_set(false);
+    } else if (!link_up && fresh) {
+        link_set(true);
+    }
+}
+
+#if CONFIG_WB_TX_ACK
+// Связи нет и окно занято: команды реле не копятся в очереди, а сразу ложатся
+// в теневое состояние и уйдут повтором после восстановления связи.
+// Уровни диммеров в теневое состояние не входят и отбрасываются.
+static void tx_hold(void)
+{
+    const wb_tx_cmd_t *cmd;
+    uint64_t mask = 0;
+    uint64_t values = 0;
+
+    do {
+        tx_collect(&mask, &values, WB_TX_QUEUE_DEPTH);
+        cmd = tx_ring_peek();
+        if (cmd != NULL) {
+            tx_ring_advance();
+            __atomic_fetch_add(&tx_stats.dropped, 1, __ATOMIC_RELAXED);
+        }
+    } while (cmd != NULL);
+    if (mask) {
+        shadow_pending(mask, values);
+    }
+}
+#endif
+#endif
+
+#if CONFIG_WB_UART_AUTOBAUD
+// Скорости для согласования, по убыванию
+static const uint32_t baud_candidates[] = {
+    5000000, 3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400,
+};
+
+// Тестовая последовательность: чередование битов, длинные серии нулей и единиц
+static const uint8_t baud_test_pattern[] = {
+    0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC,
+    0x01, 0x80, 0x7E, 0x81, 0xA5, 0x5A, 0xC3, 0x3C,
+};
+
+// Последний ответ на запрос скорости или тест, заполняется задачей приема
+static struct {
+    uint8_t type;
+    uint8_t len;
+    uint8_t data[WB_FRAME_MAX_PAYLOAD];
+} baud_reply;
+
+static uint32_t baud_errors;
+static int64_t baud_errors_since_us;
+
+static void baud_send(uint8_t type, const uint8_t *payload, uint8_t len)
+{
+    uint8_t frame[WB_FRAME_MAX_LEN];
+    size_t flen = wb_frame_encode(frame, sizeof(frame), type, 0, payload, len);
+    uart_send(frame, flen);
+}
+
+// Ждем ответ нужного типа; остальные биты уведомления сохраняются для основного цикла
+static bool baud_wait_reply(uint8_t type)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(WB_BAUD_REPLY_TIMEOUT_MS);
+    uint32_t notify;
+
+    TickType_t elapsed;
+
+    __atomic_store_n(&baud_reply.type, 0, __ATOMIC_RELAXED);
+    while ((elapsed = xTaskGetTickCount() - start) < timeout) {
+        if (xTaskNotifyWait(0, TX_NOTIFY_BAUD, &notify, timeout - elapsed) &&
+            (notify & TX_NOTIFY_BAUD) && __atomic_load_n(&baud_reply.type, __ATOMIC_ACQUIRE) == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void baud_set(uint32_t rate)
+{
+    uart_wait_tx_done(UART_PORT_NUM, pdMS_TO_TICKS(WB_BAUD_REPLY_TIMEOUT_MS));
+    uart_set_baudrate(UART_PORT_NUM, rate);
+    uart_flush_input(UART_PORT_NUM);
+    __atomic_store_n(&baud_current, rate, __ATOMIC_RELAXED);
+}
+
+// Запрос скорости на текущей скорости линии. false - Wiren Board не ответил
+// или не поддерживает rate.
+static bool baud_request(uint32_t rate, bool *answered)
+{
+    uint8_t payload[4] = { rate, rate >> 8, rate >> 16, rate >> 24 };
+
+    baud_send(WB_FRAME_BAUD_REQ, payload, sizeof(payload));
+    *answered = baud_wait_reply(WB_FRAME_BAUD_ACK);
+    return *answered && baud_reply.len == sizeof(payload) && memcmp(baud_reply.data, payload, sizeof(payload)) == 0;
+}
+
+// Переход на rate с проверкой тестовым кадром. При неудаче возвращаемся на прежнюю скорость.
+static bool baud_try(uint32_t rate, bool *answered)
+{
+    uint32_t prev = baud_current;
+
+    if (!baud_request(rate, answered)) {
+        return false;
+    }
+    baud_set(rate);
+    vTaskDelay(1);  // даем Wiren Board переключиться после отправки BAUD_ACK
+
+    baud_send(WB_FRAME_BAUD_TEST, baud_test_pattern, sizeof(baud_test_pattern));
+    if (baud_wait_reply(WB_FRAME_BAUD_TEST) && baud_reply.len == sizeof(baud_test_pattern) &&
+        memcmp(baud_reply.data, baud_test_pattern, sizeof(baud_test_pattern)) == 0) {
+        return true;
+    }
+
+    baud_set(prev);
+    vTaskDelay(pdMS_TO_TICKS(WB_BAUD_REVERT_MS));
+    return false;
+}
+
+// Поиск максимальной скорости не выше max_rate, которую подтверждают обе стороны
+static void baud_negotiate(uint32_t max_rate)
+{
+    tx_stats.baud_negotiations++;
+    for (size_t i = 0; i < sizeof(baud_candidates) / sizeof(baud_candidates[0]); i++) {
+        uint32_t rate = baud_candidates[i];
+        bool answered;
+        if (rate > max_rate || rate > CONFIG_SOC_UART_BITRATE_MAX || rate <= baud_current) {
+            continue;
+        }
+        if (baud_try(rate, &answered)) {
+            break;
+        }
+        if (!answered) {
+            break;  // Wiren Board не поддерживает согласование
+        }
+    }
+    ESP_LOGI(TAG, "UART baud rate %lu", (unsigned long)baud_current);
+}
+
+// Много ошибок приема: спускаемся на ступень ниже, при неудаче - на базовую скорость.
+// Переход на базовую скорость запрашивается на текущей, пока Wiren Board ее слышит.
+static void baud_step_down(void)
+{
+    uint32_t rate = baud_current;
+    bool answered;
+
+    tx_stats.baud_fallbacks++;
+    if (baud_request(UART_BAUD_RATE, &answered)) {
+        baud_set(UART_BAUD_RATE);
+        vTaskDelay(1);
+        // Тестовый кадр закрепляет переход, иначе Wiren Board вернется на прежнюю скорость
+        baud_send(WB_FRAME_BAUD_TEST, baud_test_pattern, sizeof(baud_test_pattern));
+        baud_wait_reply(WB_FRAME_BAUD_TEST);
+    } else {
+        // Запрос потерялся в помехах: ждем, пока Wiren Board вернется сам
+        baud_set(UART_BAUD_RATE);
+        vTaskDelay(pdMS_TO_TICKS(WB_BAUD_SILENCE_REVERT_MS));
+    }
+    baud_negotiate(rate - 1);
+    baud_errors = 0;
+}
+
+// Вызывается задачей приема на каждую ошибку линии или CRC
+static void baud_note_error(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (now - baud_errors_since_us > 1000000) {
+        baud_errors_since_us = now;
+        baud_errors = 0;
+    }
+    if (++baud_errors == CONFIG_WB_UART_BAUD_FALLBACK_ERRORS &&
+        __atomic_load_n(&baud_current, __ATOMIC_RELAXED) > UART_BAUD_RATE) {
+        xTaskNotify(tx_task_handle, TX_NOTIFY_BAUD_DOWN, eSetBits);
+    }
+}
+#endif
+
+// Задача отправки: разбирает очередь и пишет в UART. Первая команда
+// открывает окно объединения; кадр уходит по истечении окна или при
+// накоплении WB_TX_COALESCE_MAX_CMDS команд. Пока окно подтверждений
+// заполнено, команды копятся в очереди.
+static void uart_tx_task(void *pvParameters)
+{
+    uint32_t notify;
+
+#if CONFIG_WB_UART_AUTOBAUD
+    baud_negotiate(CONFIG_WB_UART_BAUD_MAX);
+    // Команды, пришедшие во время согласования, ждут в очереди
+    xTaskNotify(tx_task_handle, TX_NOTIFY_CMD, eSetBits);
+#endif
+
+    for (;;) {
+        xTaskNotifyWait(0, UINT32_MAX, &notify, portMAX_DELAY);
+#if CONFIG_WB_UART_AUTOBAUD
+        if (notify & TX_NOTIFY_BAUD_DOWN) {
+            baud_step_down();
+            notify |= TX_NOTIFY_LINK;
+        }
+#endif
+        if (notify & TX_NOTIFY_LINK) {
+            tx_service_window();
+#if WB_LINK_TRACKING && WB_TX_RESYNC
+            link_resynced();
+#endif
+        }
+#if CONFIG_WB_TX_RESYNC_INTERVAL_S
+        if (notify & TX_NOTIFY_RESYNC) {
+            resync_pending = true;
+        }
+#endif
+#if WB_LINK_TRACKING
+        if (notify & TX_NOTIFY_HEALTH) {
+            link_check();
+        }
+#endif
+        if (!tx_can_send()) {
+#if WB_LINK_TRACKING && CONFIG_WB_TX_ACK
+            if (!link_up) {
+                tx_hold();
+            }
+#endif
+            continue;
+        }
+#if WB_TX_RESYNC
+        if (resync_pending) {
+            resync_pending = false;
+            tx_resync();
+            tx_service_window();
+#if WB_LINK_TRACKING
+            link_resynced();
+#endif
+            if (!tx_can_send()) {
+                continue;
+            }
+        }
+#endif
+
+        tx_send_levels();
+        if (!tx_can_send()) {
+            continue;
+        }
+
+        uint64_t mask = 0;
+        uint64_t values = 0;
+        uint32_t count = tx_collect(&mask, &values, WB_TX_COALESCE_MAX_CMDS);
+        if (count == 0) {
+            continue;
+        }
+
+        if (WB_TX_COALESCE_WINDOW_US > 0 && count < WB_TX_COALESCE_MAX_CMDS) {
+            uint32_t deferred = 0;  // биты, которые разбирает только основной цикл
+            esp_timer_start_once(coalesce_timer, WB_TX_COALESCE_WINDOW_US);
+            do {
+                xTaskNotifyWait(0, UINT32_MAX, &notify, portMAX_DELAY);
+                deferred |= notify & TX_NOTIFY_BAUD_DOWN;
+                if (notify & TX_NOTIFY_LINK) {
+                    tx_service_window();
+#if WB_LINK_TRACKING && WB_TX_RESYNC
+                    link_resynced();
+#endif
+                }
+#if CONFIG_WB_TX_RESYNC_INTERVAL_S
+                if (notify & TX_NOTIFY_RESYNC) {
+                    resync_pending = true;
+                }
+#endif
+#if WB_LINK_TRACKING
+                if (notify & TX_NOTIFY_HEALTH) {
+                    link_check();
+                }
+#endif
+                count += tx_collect(&mask, &values, WB_TX_COALESCE_MAX_CMDS - count);
+            } while (!(notify & TX_NOTIFY_WINDOW) && count < WB_TX_COALESCE_MAX_CMDS);
+            esp_timer_stop(coalesce_timer);
+            if (deferred) {
+                xTaskNotify(tx_task_handle, deferred, eSetBits);
+            }
+        }
+
+        // Повторные записи того же значения до линии не доходят
+        mask = shadow_filter(mask, values);
+        if (mask) {
+            tx_frame_timed = true;
+            send_relays_to_wirenboard(mask, values);
+            tx_service_window();
+        }
+
+        // В очереди могли остаться команды сверх лимита пачки
+        if (__atomic_load_n(&tx_head, __ATOMIC_ACQUIRE) != tx_tail && tx_can_send()) {
+            xTaskNotify(tx_task_handle, TX_NOTIFY_CMD, eSetBits);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+#if CONFIG_WB_PROTOCOL_MODBUS
+// Интервал t3.5 в микросекундах. Выше 19200 бод стандарт фиксирует 1750 мкс.
+static uint32_t mb_t35_us(void)
+{
+    uint32_t baud = __atomic_load_n(&baud_current, __ATOMIC_RELAXED);
+    if (baud > 19200) {
+        return 1750;
+    }
+    return 35 * 11 * 1000000ULL / 10 / baud;  // 3.5 символа по 11 бит
+}
+
+// Таймаут приема в символах, покрывающий t3.5. Если t3.5 длиннее
+// аппаратного максимума, остаток досчитывает таймер.
+static uint8_t mb_rx_timeout_symbols(void)
+{
+    uint32_t baud = __atomic_load_n(&baud_current, __ATOMIC_RELAXED);
+    uint32_t symbols = ((uint64_t)mb_t35_us() * baud + 11 * 1000000 - 1) / (11 * 1000000);
+
+    if (symbols < 4) {
+        symbols = 4;
+    }
+    if (symbols > MB_RX_TIMEOUT_SYMBOLS_MAX) {
+        symbols = MB_RX_TIMEOUT_SYMBOLS_MAX;
+    }
+    mb_hw_gap_us = (uint64_t)symbols * 11 * 1000000 / baud;
+    return symbols;
+}
+
+static void mb_t35_timer_cb(void *arg)
+{
+    xSemaphoreGive(mb_t35_sem);
+}
+
+// Мастер записал катушки: те же изменения, что и отчет о состоянии реле
+static void mb_coils_written(uint64_t mask, uint64_t values)
+{
+    shadow_update(mask, values);
+    if (state_handler) {
+        state_handler(mask, values);
+    }
+}
+
+// Пауза t3.5: в буфере целый кадр. expected_us - какая пауза после последнего
+// байта должна была пройти к обнаружению конца кадра, отклонение идет в статистику.
+static void mb_rx_frame_end(uint32_t expected_us)
+{
+    uint8_t resp[MODBUS_ADU_MAX];
+    int64_t now = esp_timer_get_time();
+    uint32_t delay = now - mb_rx_last_us;
+    uint32_t jitter = delay > expected_us ? delay - expected_us : expected_us - delay;
+
+    if (jitter > mb_timing.jitter_max_us) {
+        mb_timing.jitter_max_us = jitter;
+    }
+    // Скользящее среднее с весом 1/8
+    mb_timing.jitter_avg_us += ((int32_t)jitter - (int32_t)mb_timing.jitter_avg_us) / 8;
+
+    if (mb_rx_overrun) {
+        rx_stats.overflows++;
+    } else if (mb_rx_len) {
+        rx_stats.frames++;
+        size_t len = modbus_slave_process(mb_rx_buf, mb_rx_len, resp, sizeof(resp));
+        if (len) {
+            uint32_t turnaround = esp_timer_get_time() - now;
+            if (turnaround > mb_timing.turnaround_max_us) {
+                mb_timing.turnaround_max_us = turnaround;
+            }
+            uart_send(resp, len);
+        }
+    }
+    mb_rx_len = 0;
+    mb_rx_overrun = false;
+}
+
+// Кусок кадра из драйвера. timeout_flag - драйвер отдал данные по аппаратному
+// таймауту приема, т.е. линия уже молчит mb_hw_gap_us.
+// Паузу 1.5 символа между байтами не проверяем: драйвер отдает байты кусками,
+// время прихода отдельного байта неизвестно, а оценка по событиям включала бы
+// задержку планировщика и браковала бы целые кадры. Разрыв внутри кадра ловит CRC.
+static void mb_rx_append(size_t size, bool timeout_flag)
+{
+    // Время берется до чтения: с таймаутом последний байт пришел mb_hw_gap_us назад
+    int64_t last_us = esp_timer_get_time();
+#if CONFIG_WB_MODBUS_HW_GAP
+    if (timeout_flag) {
+        last_us -= mb_hw_gap_us;
+    }
+#endif
+
+    while (size) {
+        size_t space = sizeof(mb_rx_buf) - mb_rx_len;
+        if (space == 0) {
+            // Кадр длиннее допустимого - дочитываем и выбрасываем до паузы
+            uint8_t drop[32];
+            int len = uart_read_bytes(UART_PORT_NUM, drop, size < sizeof(drop) ? size : sizeof(drop), 0);
+            if (len <= 0) {
+                break;
+            }
+            mb_rx_overrun = true;
+            size -= len;
+            continue;
+        }
+        int len = uart_read_bytes(UART_PORT_NUM, &mb_rx_buf[mb_rx_len], size < space ? size : space, 0);
+        if (len <= 0) {
+            break;
+        }
+        mb_rx_len += len;
+        size -= len;
+    }
+    mb_rx_last_us = last_us;
+    esp_timer_stop(mb_t35_timer);
+
+#if CONFIG_WB_MODBUS_HW_GAP
+    uint32_t t35 = mb_t35_us();
+    if (timeout_flag) {
+        if (mb_hw_gap_us >= t35) {
+            mb_timing.hw_frame_ends++;
+            mb_rx_frame_end(mb_hw_gap_us);
+            return;
+        }
+        // Аппаратного таймаута не хватает до t3.5 - досчитываем таймером
+        esp_timer_start_once(mb_t35_timer, t35 - mb_hw_gap_us);
+        return;
+    }
+#endif
+    // Данные по порогу FIFO или аппаратный таймаут выключен: конец кадра по таймеру
+    esp_timer_start_once(mb_t35_timer, mb_t35_us());
+}
+
+// Сработал таймер t3.5. Событие могло устареть, если после запуска таймера
+// пришел новый кусок: тогда кадр еще не закончен. Таймер заведен так, чтобы
+// сработать через t3.5 после последнего байта.
+static void mb_rx_timer_expired(void)
+{
+    uint32_t expected = mb_t35_us();
+    int64_t silent = esp_timer_get_time() - mb_rx_last_us;
+
+    if (mb_rx_len == 0 && !mb_rx_overrun) {
+        return;
+    }
+    if (silent < expected) {
+        return;
+    }
+    mb_timing.sw_frame_ends++;
+    mb_rx_frame_end(expected);
+}
+#endif
+
+#if CONFIG_WB_PROTOCOL_BINARY
+// ACK пишется из задачи приема без ожидания конца передачи: в RS-485 DE
+// переключает сам UART по RTS, а прием не стоит, пока кадр уходит в линию.
+// Коллизию ACK не проверяем - потерянный ACK закроет повтор Wiren Board.
+static void uart_rx_send_ack(uint8_t seq)
+{
+    uint8_t frame[WB_FRAME_HDR_LEN + WB_FRAME_CRC_LEN];
+    size_t len = wb_frame_encode(frame, sizeof(frame), WB_FRAME_ACK, seq, NULL, 0);
+    uart_write_bytes(UART_PORT_NUM, frame, len);
+}
+
+// Обработка принятого кадра от Wiren Board
+static void uart_rx_handle_frame(const wb_frame_t *frame)
+{
+    switch (frame->type) {
+    case WB_FRAME_STATE: {
+        uint64_t mask, values;
+        if (!wb_frame_get_relays(frame, &mask, &values)) {
+            rx_stats.errors++;
+            break;
+        }
+        rx_stats.state_reports++;
+        shadow_reported(mask, values);
+        if (state_handler) {
+            state_handler(mask, values);
+        }
+        uart_rx_send_ack(frame->seq);
+        break;
+    }
+#if CONFIG_WB_TX_ACK
+    case WB_FRAME_ACK: {
+        int64_t now = esp_timer_get_time();
+        if (wb_window_ack(frame->seq, now)) {
+            tx_latency_acked(frame->seq, now);
+            shadow_frame_acked(frame->seq);
+#if WB_LINK_TRACKING && WB_TX_RESYNC
+            if (frame->seq == link_resync_seq) {
+                __atomic_store_n(&link_resync_wait, false, __ATOMIC_RELEASE);
+            }
+#endif
+            xTaskNotify(tx_task_handle, TX_NOTIFY_LINK, eSetBits);
+        }
+        break;
+    }
+    case WB_FRAME_NAK:
+        if (wb_window_nak(frame->seq)) {
+            xTaskNotify(tx_task_handle, TX_NOTIFY_LINK, eSetBits);
+        }
+        break;
+#endif
+#if WB_LINK_TRACKING
+    case WB_FRAME_PONG:
+        break;  // связь учтена счетчиком кадров
+#endif
+#if CONFIG_WB_UART_AUTOBAUD
+    case WB_FRAME_BAUD_ACK:
+    case WB_FRAME_BAUD_TEST:
+        baud_reply.len = frame->len;
+        memcpy(baud_reply.data, frame->payload, frame->len);
+        // Тип публикуется последним: задача отправки читает данные после него
+        __atomic_store_n(&baud_reply.type, frame->type, __ATOMIC_RELEASE);
+        xTaskNotify(tx_task_handle, TX_NOTIFY_BAUD, eSetBits);
+        break;
+#endif
+    default:
+        rx_stats.unknown++;
+        break;
+    }
+}
+
+// Разбор всех целых кадров из приемного кольца
+static void uart_rx_parse(void)
+{
+    wb_frame_t frame;
+    wb_parse_result_t res;
+
+    while ((res = wb_rx_ring_next_frame(&rx_ring, &frame)) != WB_PARSE_NEED_MORE) {
+        if (res == WB_PARSE_OK) {
+            rx_stats.frames++;
+            uart_rx_handle_frame(&frame);
+        } else {
+            rx_stats.errors++;
+#if CONFIG_WB_UART_AUTOBAUD
+            baud_note_error();
+#endif
+        }
+    }
+}
+#endif
+
+// UART обработчик событий. Границы кадров находит аппаратный таймаут
+// приема: событие UART_DATA приходит после паузы WB_RX_TIMEOUT_SYMBOLS
+// символов, обычно сразу с целым кадром. В режиме Modbus таймаут равен
+// t3.5, а таймер t3.5 страхует случаи, когда драйвер отдал данные по порогу FIFO.
+static void uart_event_task(void *pvParameters)
+{
+    uart_event_t event;
+
+    for (;;) {
+#if CONFIG_WB_PROTOCOL_MODBUS
+        // Очередь событий принадлежит драйверу, таймер t3.5 сигналит отдельным семафором
+        if (xQueueSelectFromSet(mb_rx_set, portMAX_DELAY) == mb_t35_sem) {
+            xSemaphoreTake(mb_t35_sem, 0);
+            mb_rx_timer_expired();
+            continue;
+        }
+        if (xQueueReceive(uart_queue, (void *)&event, 0)) {
+#else
+        if (xQueueReceive(uart_queue, (void *)&event, portMAX_DELAY)) {
+#endif
+            switch (event.type) {
+#if CONFIG_WB_PROTOCOL_MODBUS
+                case UART_DATA:
+                    mb_rx_append(event.size, event.timeout_flag);
+                    break;
+#else
+                case UART_DATA: {
+                    // Читаем прямо в кольцо, максимум двумя кусками при переходе через границу
+                    size_t left = event.size;
+                    while (left) {
+                        size_t space;
+                        uint8_t *dst = wb_rx_ring_write_ptr(&rx_ring, &space);
+                        if (space == 0) {
+                            break;
+                        }
+                        int len = uart_read_bytes(UART_PORT_NUM, dst, left < space ? left : space, 0);
+                        if (len <= 0) {
+                            break;
+                        }
+                        wb_rx_ring_commit(&rx_ring, len);
+                        left -= len;
+#if CONFIG_WB_PROTOCOL_BINARY
+                        uart_rx_parse();
+#else
+                        wb_rx_ring_reset(&rx_ring);
+#endif
+                    }
+                    break;
+                }
+#endif
+
+                case UART_FIFO_OVF:
+                case UART_BUFFER_FULL:
+                    ESP_LOGW(TAG, "UART buffer overflow");
+                    rx_stats.overflows++;
+                    uart_flush_input(UART_PORT_NUM);
+#if CONFIG_WB_PROTOCOL_MODBUS
+                    mb_rx_overrun = true;
+#else
+                    wb_rx_ring_reset(&rx_ring);
+#endif
+                    break;
+
+                case UART_FRAME_ERR:
+                case UART_PARITY_ERR:
+                case UART_BREAK:
+                    rx_stats.line_errors++;
+#if CONFIG_WB_UART_AUTOBAUD
+                    baud_note_error();
+#endif
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+// UART инициализация с реальными выводами
+static esp_err_t uart_driver_init(void)
+{
+    uart_config_t uart_config = {
+        .baud_rate = UART_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    // Install UART driver with event queue
+    esp_err_t ret = uart_driver_install(UART_PORT_NUM,
+                                      UART_BUF_SIZE * 2,
+                                      UART_BUF_SIZE * 2,
+                                      UART_QUEUE_SIZE,
+                                      &uart_queue,
+                                      0);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UART driver install failed");
+        return ret;
+    }
+
+    ret = uart_param_config(UART_PORT_NUM, &uart_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UART param config failed");
+        return ret;
+    }
+
+    // Устанавливаем пины для реального UART
+    ret = uart_set_pin(UART_PORT_NUM, UART_TX_PIN, UART_RX_PIN, UART_RTS_PIN, UART_PIN_NO_CHANGE);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UART pin config failed");
+        return ret;
+    }
+
+#if CONFIG_WB_UART_RS485
+    // Полудуплекс: RTS поднимается аппаратно на время передачи
+    ret = uart_set_mode(UART_PORT_NUM, UART_MODE_RS485_HALF_DUPLEX);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UART RS-485 mode failed");
+        return ret;
+    }
+    // Пауза перед передачей, чтобы другая сторона успела отпустить шину
+    ret = uart_set_tx_idle_num(UART_PORT_NUM, CONFIG_WB_UART_RS485_TURNAROUND_BITS);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UART RS-485 turnaround config failed");
+        return ret;
+    }
+#endif
+
+    // Короткий таймаут приема: кадр отдается сразу после паузы на линии
+#if CONFIG_WB_PROTOCOL_MODBUS
+    ret = uart_set_rx_timeout(UART_PORT_NUM, mb_rx_timeout_symbols());
+#else
+    ret = uart_set_rx_timeout(UART_PORT_NUM, WB_RX_TIMEOUT_SYMBOLS);
+#endif
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "UART RX timeout config failed");
+        return ret;
+    }
+
+#if CONFIG_WB_UART_RS485
+    ESP_LOGI(TAG, "UART initialized with TX=%d, RX=%d, RS-485 DE=%d", UART_TX_PIN, UART_RX_PIN, UART_RTS_PIN);
+#else
+    ESP_LOGI(TAG, "UART initialized with TX=%d, RX=%d", UART_TX_PIN, UART_RX_PIN);
+#endif
+    return ESP_OK;
+}
+
+esp_err_t wb_uart_init(void)
+{
+    esp_err_t ret = uart_driver_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = coalesce_timer_cb,
+        .name = "wb_coalesce",
+    };
+    ret = esp_timer_create(&timer_args, &coalesce_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Coalesce timer create failed");
+        return ret;
+    }
+
+#if CONFIG_WB_PROTOCOL_MODBUS
+    modbus_slave_init(CONFIG_WB_MODBUS_SLAVE_ADDR, ENDPOINT_UART_CHANNELS, mb_coils_written);
+    const esp_timer_create_args_t t35_args = {
+        .callback = mb_t35_timer_cb,
+        .name = "mb_t35",
+    };
+    ret = esp_timer_create(&t35_args, &mb_t35_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Modbus t3.5 timer create failed");
+        return ret;
+    }
+    // В набор добавляется только пустая очередь: события до этого момента не нужны
+    xQueueReset(uart_queue);
+    mb_t35_sem = xSemaphoreCreateBinary();
+    mb_rx_set = xQueueCreateSet(UART_QUEUE_SIZE + 1);
+    if (mb_t35_sem == NULL || mb_rx_set == NULL ||
+        xQueueAddToSet(uart_queue, mb_rx_set) != pdPASS ||
+        xQueueAddToSet(mb_t35_sem, mb_rx_set) != pdPASS) {
+        ESP_LOGE(TAG, "Modbus RX queue set create failed");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+#if CONFIG_WB_TX_ACK
+    wb_window_init();
+    const esp_timer_create_args_t retx_args = {
+        .callback = retx_timer_cb,
+        .name = "wb_retx",
+    };
+    ret = esp_timer_create(&retx_args, &retx_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Retransmit timer create failed");
+        return ret;
+    }
+#endif
+
+#if CONFIG_WB_TX_RESYNC_INTERVAL_S
+    const esp_timer_create_args_t resync_args = {
+        .callback = resync_timer_cb,
+        .name = "wb_resync",
+    };
+    ret = esp_timer_create(&resync_args, &resync_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Resync timer create failed");
+        return ret;
+    }
+#endif
+
+#if WB_LINK_TRACKING
+    const esp_timer_create_args_t link_args = {
+        .callback = link_timer_cb,
+        .name = "wb_link",
+    };
+    ret = esp_timer_create(&link_args, &link_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Link timer create failed");
+        return ret;
+    }
+#endif
+
+    if (xTaskCreate(uart_tx_task, "uart_tx", 2048, NULL, WB_TX_TASK_PRIO, &tx_task_handle) != pdPASS ||
+        xTaskCreate(uart_event_task, "uart_task", 2048, NULL, 10, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "UART task create failed");
+        return ESP_ERR_NO_MEM;
+    }
+#if CONFIG_WB_TX_RESYNC_INTERVAL_S
+    esp_timer_start_periodic(resync_timer, CONFIG_WB_TX_RESYNC_INTERVAL_S * 1000000ULL);
+#endif
+#if WB_LINK_TRACKING
+    esp_timer_start_periodic(link_timer, CONFIG_WB_LINK_HEARTBEAT_MS * 1000ULL);
+#endif
+    ESP_LOGI(TAG, "TX queue depth %d, coalesce window %d us / %d cmds",
+             WB_TX_QUEUE_DEPTH, WB_TX_COALESCE_WINDOW_US, WB_TX_COALESCE_MAX_CMDS);
+    return ESP_OK;
+}
+
+esp_err_t wb_uart_send_relay(uint8_t channel, bool state)
+{
+    wb_tx_cmd_t cmd = {
+        .channel = channel,
+        .state = state,
+        .level = WB_TX_LEVEL_NONE,
+        .enq_us = esp_timer_get_time(),
+    };
+
+    if (!tx_ring_push(&cmd)) {
+        __atomic_fetch_add(&tx_stats.dropped, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+    __atomic_fetch_add(&tx_stats.enqueued, 1, __ATOMIC_RELAXED);
+    xTaskNotify(tx_task_handle, TX_NOTIFY_CMD, eSetBits);
+    return ESP_OK;
+}
+
+esp_err_t wb_uart_send_relays(uint64_t mask, uint64_t values)
+{
+    if (mask == 0) {
+        return ESP_OK;
+    }
+    if (!tx_ring_push_relays(mask, values)) {
+        __atomic_fetch_add(&tx_stats.dropped, __builtin_popcountll(mask), __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+    __atomic_fetch_add(&tx_stats.enqueued, __builtin_popcountll(mask), __ATOMIC_RELAXED);
+    xTaskNotify(tx_task_handle, TX_NOTIFY_CMD, eSetBits);
+    return ESP_OK;
+}
+
+bool wb_uart_relays_confirmed(uint64_t mask, uint64_t values)
+{
+    relay_bits_snapshot_t snap;
+    relay_bits_snapshot(&shadow, &snap);
+    uint64_t same = relay_bits_get64(&snap, SHADOW_KNOWN_WORD) &
+                    ~(values ^ relay_bits_get64(&snap, SHADOW_VALUES_WORD));
+
+    return (mask & same) == mask;
+}
+
+esp_err_t wb_uart_send_level(uint8_t channel, uint8_t level, uint16_t transition)
+{
+    wb_tx_cmd_t cmd = {
+        .channel = channel,
+        .level = level,
+        .transition = transition,
+        .enq_us = esp_timer_get_time(),
+    };
+
+    if (level == WB_TX_LEVEL_NONE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!tx_ring_push(&cmd)) {
+        __atomic_fetch_add(&tx_stats.dropped, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+    __atomic_fetch_add(&tx_stats.enqueued, 1, __ATOMIC_RELAXED);
+    xTaskNotify(tx_task_handle, TX_NOTIFY_CMD, eSetBits);
+    return ESP_OK;
+}
+
+void wb_uart_register_state_handler(wb_uart_state_cb_t cb)
+{
+    state_handler = cb;
+}
+
+void wb_uart_register_link_handler(wb_uart_link_cb_t cb)
+{
+#if WB_LINK_TRACKING
+    link_handler = cb;
+#endif
+}
+
+bool wb_uart_link_up(void)
+{
+#if WB_LINK_TRACKING
+    return __atomic_load_n(&link_up, __ATOMIC_RELAXED);
+#else
+    return true;
+#endif
+}
+
+void wb_uart_get_tx_stats(wb_uart_tx_stats_t *stats)
+{
+    stats->enqueued = __atomic_load_n(&tx_stats.enqueued, __ATOMIC_RELAXED);
+    stats->sent = __atomic_load_n(&tx_stats.sent, __ATOMIC_RELAXED);
+    stats->frames = __atomic_load_n(&tx_stats.frames, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&tx_stats.dropped, __ATOMIC_RELAXED);
+    stats->high_water = __atomic_load_n(&tx_stats.high_water, __ATOMIC_RELAXED);
+    stats->baud_negotiations = __atomic_load_n(&tx_stats.baud_negotiations, __ATOMIC_RELAXED);
+    stats->baud_fallbacks = __atomic_load_n(&tx_stats.baud_fallbacks, __ATOMIC_RELAXED);
+    stats->collisions = __atomic_load_n(&tx_stats.collisions, __ATOMIC_RELAXED);
+    stats->suppressed = __atomic_load_n(&tx_stats.suppressed, __ATOMIC_RELAXED);
+    stats->resyncs = __atomic_load_n(&tx_stats.resyncs, __ATOMIC_RELAXED);
+    stats->link_losses = __atomic_load_n(&tx_stats.link_losses, __ATOMIC_RELAXED);
+    stats->latency_samples = __atomic_load_n(&tx_stats.latency_samples, __ATOMIC_ACQUIRE);
+    stats->latency_avg_us = __atomic_load_n(&tx_stats.latency_avg_us, __ATOMIC_RELAXED);
+    stats->latency_max_us = __atomic_load_n(&tx_stats.latency_max_us, __ATOMIC_RELAXED);
+}
+
+void wb_uart_get_rx_stats(wb_uart_rx_stats_t *stats)
+{
+    stats->frames = __atomic_load_n(&rx_stats.frames, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&rx_stats.errors, __ATOMIC_RELAXED);
+    stats->unknown = __atomic_load_n(&rx_stats.unknown, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&rx_stats.overflows, __ATOMIC_RELAXED);
+    stats->line_errors = __atomic_load_n(&rx_stats.line_errors, __ATOMIC_RELAXED);
+    stats->state_reports = __atomic_load_n(&rx_stats.state_reports, __ATOMIC_RELAXED);
+}
+
+void wb_uart_get_modbus_timing(wb_uart_modbus_timing_t *timing)
+{
+#if CONFIG_WB_PROTOCOL_MODBUS
+    timing->hw_frame_ends = __atomic_load_n(&mb_timing.hw_frame_ends, __ATOMIC_RELAXED);
+    timing->sw_frame_ends = __atomic_load_n(&mb_timing.sw_frame_ends, __ATOMIC_RELAXED);
+    timing->t35_us = mb_t35_us();
+    timing->hw_gap_us = mb_hw_gap_us;
+    timing->jitter_max_us = __atomic_load_n(&mb_timing.jitter_max_us, __ATOMIC_RELAXED);
+    timing->jitter_avg_us = __atomic_load_n(&mb_timing.jitter_avg_us, __ATOMIC_RELAXED);
+    timing->turnaround_max_us = __atomic_load_n(&mb_timing.turnaround_max_us, __ATOMIC_RELAXED);
+#else
+    memset(timing, 0, sizeof(*timing));
+#endif
+}
+
+uint32_t wb_uart_get_baudrate(void)
+{
+    return __atomic_load_n(&baud_current, __ATOMIC_RELAXED);
+}
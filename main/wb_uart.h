@@ -0,0 +1,95 @@
+// wb_uart.h
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Счетчики очереди отправки
+typedef struct {
+    uint32_t enqueued;    // принято в очередь
+    uint32_t sent;        // команд записано в UART
+    uint32_t frames;      // кадров записано в UART (после объединения)
+    uint32_t dropped;     // отброшено из-за переполнения очереди
+    uint32_t high_water;  // максимальное заполнение очереди
+    uint32_t baud_negotiations;  // попыток согласования скорости
+    uint32_t baud_fallbacks;     // понижений скорости из-за ошибок
+    uint32_t collisions;         // коллизий на шине RS-485
+    uint32_t suppressed;  // команд, совпавших с последним известным состоянием канала
+    uint32_t resyncs;     // повторов состояния всех каналов
+    uint32_t link_losses; // потерь связи с Wiren Board
+    // Задержка команды от приема до подтверждения кадра Wiren Board (без
+    // подтверждений - до записи в UART, в Modbus - до обновления катушек)
+    uint32_t latency_samples;
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+} wb_uart_tx_stats_t;
+
+// Счетчики приема
+typedef struct {
+    uint32_t frames;      // принято корректных кадров
+    uint32_t errors;      // битых кадров (CRC/длина)
+    uint32_t unknown;     // кадров неизвестного типа
+    uint32_t state_reports; // отчетов о состоянии реле
+    uint32_t overflows;   // переполнений приемного буфера UART
+    uint32_t line_errors; // ошибок кадра/четности/break на линии
+} wb_uart_rx_stats_t;
+
+// Точность обнаружения границ кадров Modbus
+typedef struct {
+    uint32_t hw_frame_ends;     // конец кадра по аппаратному таймауту приема
+    uint32_t sw_frame_ends;     // по таймеру t3.5
+    uint32_t t35_us;            // требуемая пауза между кадрами
+    uint32_t hw_gap_us;         // пауза, которую отмеряет аппаратный таймаут
+    uint32_t jitter_max_us;     // отклонение момента обнаружения от ожидаемого
+    uint32_t jitter_avg_us;
+    uint32_t turnaround_max_us; // от конца запроса до записи ответа
+} wb_uart_modbus_timing_t;
+
+// Обработчик отчетов Wiren Board о фактическом состоянии реле (бит i = канал i).
+// Вызывается из задачи приема, один раз на кадр.
+typedef void (*wb_uart_state_cb_t)(uint64_t mask, uint64_t values);
+
+// Смена состояния связи с Wiren Board. Вызывается из задачи отправки:
+// о потере - сразу, о восстановлении - после повтора состояния всех каналов.
+typedef void (*wb_uart_link_cb_t)(bool up);
+
+// Инициализация UART и запуск задач приема/отправки
+esp_err_t wb_uart_init(void);
+
+// Постановка команды для канала реле (0..63, см. endpoints.csv) в очередь
+// отправки. Не блокирует: вызывается из колбэков Zigbee-стека.
+// Возвращает ESP_ERR_NO_MEM, если очередь полна.
+esp_err_t wb_uart_send_relay(uint8_t channel, bool state);
+
+// Набор каналов одной командой: mask - какие каналы, values - их состояние.
+// Пачка не делится между кадрами (в Modbus - одно обновление катушек).
+// ESP_ERR_NO_MEM - в очереди нет места под всю пачку, не уходит ничего.
+esp_err_t wb_uart_send_relays(uint64_t mask, uint64_t values);
+
+// Wiren Board принял состояние values для всех каналов mask: с подтверждениями -
+// пришел ACK, без них - кадр записан в UART (в Modbus - катушки обновлены).
+// Команда в очереди, в пути или потерянная еще не принята.
+bool wb_uart_relays_confirmed(uint64_t mask, uint64_t values);
+
+// Переход диммера на канале к level (0..254) за transition десятых секунды.
+// Уходит одним кадром в порядке очереди с командами реле.
+esp_err_t wb_uart_send_level(uint8_t channel, uint8_t level, uint16_t transition);
+
+void wb_uart_register_state_handler(wb_uart_state_cb_t cb);
+void wb_uart_register_link_handler(wb_uart_link_cb_t cb);
+
+// Есть ли связь с Wiren Board. Всегда true, если связь не отслеживается
+// (текстовый режим или CONFIG_WB_LINK_TIMEOUT_MS = 0).
+bool wb_uart_link_up(void);
+
+void wb_uart_get_tx_stats(wb_uart_tx_stats_t *stats);
+void wb_uart_get_rx_stats(wb_uart_rx_stats_t *stats);
+
+// Нули, если выбран не Modbus
+void wb_uart_get_modbus_timing(wb_uart_modbus_timing_t *timing);
+
+// Текущая скорость линии после согласования
+uint32_t wb_uart_get_baudrate(void);
+
+// Счетчики подтверждений, повторов и RTT - см. wb_window_get_stats()
@@ -0,0 +1,182 @@
+// wb_window.c
+#include "wb_window.h"
+#include "wb_protocol.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+// Окно нужно только для подтверждаемой доставки
+#if CONFIG_WB_TX_ACK
+
+#define WB_TX_WINDOW_SIZE   CONFIG_WB_TX_WINDOW_SIZE
+#define WB_TX_MAX_RETRIES   CONFIG_WB_TX_MAX_RETRIES
+#define WB_RTO_INIT_US      (CONFIG_WB_TX_ACK_TIMEOUT_MS * 1000)
+#define WB_RTO_MIN_US       2000
+#define WB_RTO_MAX_US       1000000
+
+_Static_assert((WB_TX_WINDOW_SIZE & (WB_TX_WINDOW_SIZE - 1)) == 0 && WB_TX_WINDOW_SIZE <= 128,
+               "CONFIG_WB_TX_WINDOW_SIZE must be a power of two not above 128");
+
+typedef struct {
+    bool used;
+    bool nak;             // запрошен немедленный повтор
+    uint8_t seq;
+    uint8_t retries;
+    uint8_t len;
+    int64_t sent_us;      // время первой отправки, для RTT
+    int64_t deadline_us;  // время следующего повтора
+    uint8_t frame[WB_FRAME_MAX_LEN];
+} wb_window_slot_t;
+
+static wb_window_slot_t slots[WB_TX_WINDOW_SIZE];
+static wb_window_stats_t stats;
+// Оценка RTT по Jacobson/Karels, в микросекундах
+static int32_t srtt_us;
+static int32_t rttvar_us;
+static int32_t rto_us = WB_RTO_INIT_US;
+static portMUX_TYPE window_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline wb_window_slot_t *slot_for(uint8_t seq)
+{
+    return &slots[seq & (WB_TX_WINDOW_SIZE - 1)];
+}
+
+static void rtt_update(int32_t sample_us)
+{
+    if (srtt_us == 0) {
+        srtt_us = sample_us;
+        rttvar_us = sample_us / 2;
+    } else {
+        int32_t err = sample_us - srtt_us;
+        srtt_us += err / 8;
+        rttvar_us += ((err < 0 ? -err : err) - rttvar_us) / 4;
+    }
+    rto_us = srtt_us + 4 * rttvar_us;
+    if (rto_us < WB_RTO_MIN_US) {
+        rto_us = WB_RTO_MIN_US;
+    } else if (rto_us > WB_RTO_MAX_US) {
+        rto_us = WB_RTO_MAX_US;
+    }
+
+    stats.srtt_us = srtt_us;
+    stats.rto_us = rto_us;
+    if ((uint32_t)sample_us > stats.rtt_max_us) {
+        stats.rtt_max_us = sample_us;
+    }
+}
+
+void wb_window_init(void)
+{
+    portENTER_CRITICAL(&window_lock);
+    memset(slots, 0, sizeof(slots));
+    memset(&stats, 0, sizeof(stats));
+    srtt_us = 0;
+    rttvar_us = 0;
+    rto_us = WB_RTO_INIT_US;
+    stats.rto_us = rto_us;
+    portEXIT_CRITICAL(&window_lock);
+}
+
+bool wb_window_has_room(uint8_t seq)
+{
+    return !__atomic_load_n(&slot_for(seq)->used, __ATOMIC_ACQUIRE);
+}
+
+void wb_window_push(uint8_t seq, const uint8_t *frame, size_t len, int64_t now_us)
+{
+    wb_window_slot_t *slot = slot_for(seq);
+
+    portENTER_CRITICAL(&window_lock);
+    memcpy(slot->frame, frame, len);
+    slot->len = len;
+    slot->seq = seq;
+    slot->retries = 0;
+    slot->nak = false;
+    slot->sent_us = now_us;
+    slot->deadline_us = now_us + rto_us;
+    slot->used = true;
+    stats.in_flight++;
+    portEXIT_CRITICAL(&window_lock);
+}
+
+bool wb_window_ack(uint8_t seq, int64_t now_us)
+{
+    wb_window_slot_t *slot = slot_for(seq);
+    bool found = false;
+
+    portENTER_CRITICAL(&window_lock);
+    if (slot->used && slot->seq == seq) {
+        // Алгоритм Карна: по повторенным кадрам RTT не оцениваем
+        if (slot->retries == 0) {
+            rtt_update((int32_t)(now_us - slot->sent_us));
+        }
+        slot->used = false;
+        stats.acked++;
+        stats.in_flight--;
+        found = true;
+    }
+    portEXIT_CRITICAL(&window_lock);
+    return found;
+}
+
+bool wb_window_nak(uint8_t seq)
+{
+    wb_window_slot_t *slot = slot_for(seq);
+    bool found = false;
+
+    portENTER_CRITICAL(&window_lock);
+    stats.naks++;
+    if (slot->used && slot->seq == seq) {
+        slot->nak = true;
+        found = true;
+    }
+    portEXIT_CRITICAL(&window_lock);
+    return found;
+}
+
+int64_t wb_window_service(int64_t now_us, wb_window_send_t send)
+{
+    uint8_t frame[WB_FRAME_MAX_LEN];
+    int64_t next_deadline = 0;
+
+    for (int i = 0; i < WB_TX_WINDOW_SIZE; i++) {
+        wb_window_slot_t *slot = &slots[i];
+        size_t len = 0;
+
+        portENTER_CRITICAL(&window_lock);
+        if (slot->used && (slot->nak || now_us >= slot->deadline_us)) {
+            if (slot->retries >= WB_TX_MAX_RETRIES) {
+                slot->used = false;
+                stats.failed++;
+                stats.in_flight--;
+            } else {
+                slot->retries++;
+                slot->nak = false;
+                // Экспоненциальная задержка между повторами
+                int64_t backoff = (int64_t)rto_us << slot->retries;
+                slot->deadline_us = now_us + (backoff > WB_RTO_MAX_US ? WB_RTO_MAX_US : backoff);
+                stats.retransmits++;
+                len = slot->len;
+                memcpy(frame, slot->frame, len);
+            }
+        }
+        if (slot->used && (next_deadline == 0 || slot->deadline_us < next_deadline)) {
+            next_deadline = slot->deadline_us;
+        }
+        portEXIT_CRITICAL(&window_lock);
+
+        // Запись в UART вне критической секции
+        if (len) {
+            send(frame, len);
+        }
+    }
+    return next_deadline;
+}
+
+void wb_window_get_stats(wb_window_stats_t *out)
+{
+    portENTER_CRITICAL(&window_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&window_lock);
+}
+
+#endif // CONFIG_WB_TX_ACK
@@ -0,0 +1,42 @@
+// wb_window.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Скользящее окно подтверждаемых кадров. Кадр с номером seq занимает
+// слот seq % WB_TX_WINDOW_SIZE, поэтому новый кадр можно отправить, только
+// если кадр на WB_TX_WINDOW_SIZE назад уже подтвержден.
+// wb_window_push/wb_window_service вызывает только задача отправки,
+// wb_window_ack/wb_window_nak - задача приема.
+
+typedef struct {
+    uint32_t acked;        // подтверждено кадров
+    uint32_t naks;         // получено NAK
+    uint32_t retransmits;  // повторных отправок
+    uint32_t failed;       // кадров отброшено после исчерпания попыток
+    uint32_t srtt_us;      // сглаженное время ответа
+    uint32_t rtt_max_us;   // максимальное время ответа
+    uint32_t rto_us;       // текущий таймаут повтора
+    uint32_t in_flight;    // кадров ожидают подтверждения
+} wb_window_stats_t;
+
+typedef void (*wb_window_send_t)(const uint8_t *frame, size_t len);
+
+void wb_window_init(void);
+
+// Есть ли свободный слот для кадра с номером seq
+bool wb_window_has_room(uint8_t seq);
+
+// Запоминает отправленный кадр до подтверждения
+void wb_window_push(uint8_t seq, const uint8_t *frame, size_t len, int64_t now_us);
+
+bool wb_window_ack(uint8_t seq, int64_t now_us);
+bool wb_window_nak(uint8_t seq);
+
+// Повторно отправляет кадры с истекшим таймером или получившие NAK.
+// Возвращает время ближайшего следующего таймаута или 0, если окно пусто.
+int64_t wb_window_service(int64_t now_us, wb_window_send_t send);
+
+void wb_window_get_stats(wb_window_stats_t *stats);
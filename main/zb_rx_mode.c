@@ -0,0 +1,269 @@
+// zb_rx_mode.c
+#include "zb_rx_mode.h"
+#include "wb_uart.h"
+#include "esp_log.h"
+#include "ha/esp_zigbee_ha_standard.h"
+#include "zboss_api.h"
+
+static const char *TAG = "ZB_RX_MODE";
+
+// Интервалы Poll Control задаются в четвертях секунды
+#define QS_TO_MS(qs)  ((uint32_t)(qs) * 250)
+
+// Атрибуты и команды Poll Control (ZCL 3.16)
+#define POLL_ATTR_CHECKIN_INTERVAL     0x0000
+#define POLL_ATTR_LONG_POLL_INTERVAL   0x0001
+#define POLL_ATTR_SHORT_POLL_INTERVAL  0x0002
+#define POLL_ATTR_FAST_POLL_TIMEOUT    0x0003
+#define POLL_CMD_CHECK_IN              0x00  // к клиенту
+#define POLL_CMD_CHECK_IN_RESPONSE     0x00  // от клиента
+#define POLL_CMD_FAST_POLL_STOP        0x01
+#define POLL_CMD_SET_LONG_POLL         0x02
+#define POLL_CMD_SET_SHORT_POLL        0x03
+
+#define POLL_SHORT_INTERVAL_QS  2  // 0.5 с, частый опрос
+#define POLL_LONG_MIN_QS        4  // длинный интервал не короче 1 с
+
+static bool joined;
+
+#if CONFIG_ZB_RX_MODE_SLEEPY
+static uint8_t poll_endpoint;
+static uint32_t long_poll_qs = CONFIG_ZB_LONG_POLL_INTERVAL_MS / 250;
+static uint16_t short_poll_qs = POLL_SHORT_INTERVAL_QS;
+static bool fast_polling;
+
+// Значение атрибута, который хаб может перезаписать (Check-in Interval, Fast Poll Timeout)
+static uint32_t poll_attr_get(uint16_t attr_id, uint32_t def)
+{
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(poll_endpoint, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL,
+                                                        ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attr_id);
+    if (attr == NULL || attr->data_p == NULL) {
+        return def;
+    }
+    return attr->type == ESP_ZB_ZCL_ATTR_TYPE_U32 ? *(uint32_t *)attr->data_p : *(uint16_t *)attr->data_p;
+}
+
+static void fast_poll_end(uint8_t param)
+{
+    (void)param;
+    fast_polling = false;
+    zb_zdo_pim_set_long_poll_interval(QS_TO_MS(long_poll_qs));
+}
+
+// Частый опрос на timeout_qs; повторный вызов продлевает окно
+static void fast_poll_start(uint32_t timeout_qs)
+{
+    if (!joined) {
+        return;
+    }
+    esp_zb_scheduler_alarm_cancel(fast_poll_end, 0);
+    if (!fast_polling) {
+        fast_polling = true;
+        zb_zdo_pim_set_long_poll_interval(QS_TO_MS(short_poll_qs));
+    }
+    esp_zb_scheduler_alarm(fast_poll_end, 0, QS_TO_MS(timeout_qs));
+}
+
+static void fast_poll_stop(void)
+{
+    esp_zb_scheduler_alarm_cancel(fast_poll_end, 0);
+    fast_poll_end(0);
+}
+
+// Check-in по привязкам; ответ ждем в режиме частого опроса
+static void checkin_send(uint8_t param)
+{
+    (void)param;
+    uint32_t interval = poll_attr_get(POLL_ATTR_CHECKIN_INTERVAL, 0);
+
+    if (!joined) {
+        return;
+    }
+    if (interval == 0) {
+        // Хаб выключил check-in: проверим атрибут через интервал по умолчанию
+        esp_zb_scheduler_alarm(checkin_send, 0, CONFIG_ZB_CHECKIN_INTERVAL_S * 1000U);
+        return;
+    }
+    esp_zb_zcl_custom_cluster_cmd_req_t req = {
+        .zcl_basic_cmd.src_endpoint = poll_endpoint,
+        .address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT,
+        .profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+        .cluster_id = ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL,
+        .direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI,
+        .custom_cmd_id = POLL_CMD_CHECK_IN,
+        .data.type = ESP_ZB_ZCL_ATTR_TYPE_NULL,
+    };
+    esp_zb_zcl_custom_cluster_cmd_req(&req);
+    fast_poll_start(poll_attr_get(POLL_ATTR_FAST_POLL_TIMEOUT, CONFIG_ZB_FAST_POLL_TIMEOUT_MS / 250));
+    esp_zb_scheduler_alarm(checkin_send, 0, QS_TO_MS(interval));
+}
+#endif
+
+#if CONFIG_ZB_LATENCY_LOG_S
+// Задержка до реле Wiren Board за последний период. В режиме sleepy к ней
+// добавляется ожидание команды у родителя - до одного интервала опроса.
+static void latency_log(uint8_t param)
+{
+    static uint32_t samples_seen;
+    wb_uart_tx_stats_t stats;
+
+    (void)param;
+    wb_uart_get_tx_stats(&stats);
+    if (stats.latency_samples != samples_seen) {
+        samples_seen = stats.latency_samples;
+#if CONFIG_ZB_RX_MODE_SLEEPY
+        ESP_LOGI(TAG, "Command latency: %u cmds, avg %u us, max %u us, plus poll wait up to %u ms (%s)",
+                 (unsigned)stats.latency_samples, (unsigned)stats.latency_avg_us, (unsigned)stats.latency_max_us,
+                 (unsigned)QS_TO_MS(fast_polling ? short_poll_qs : long_poll_qs),
+                 fast_polling ? "fast poll" : "long poll");
+#else
+        ESP_LOGI(TAG, "Command latency: %u cmds, avg %u us, max %u us (receiver always on)",
+                 (unsigned)stats.latency_samples, (unsigned)stats.latency_avg_us, (unsigned)stats.latency_max_us);
+#endif
+    }
+    esp_zb_scheduler_alarm(latency_log, 0, CONFIG_ZB_LATENCY_LOG_S * 1000U);
+}
+#endif
+
+void zb_rx_mode_add_clusters(esp_zb_cluster_list_t *cluster_list, uint8_t endpoint)
+{
+#if CONFIG_ZB_RX_MODE_SLEEPY
+    // В esp-zigbee-lib нет готового кластера Poll Control: атрибуты
+    // объявляем сами, команды разбирает zb_rx_mode_handle_command()
+    esp_zb_attribute_list_t *attr_list = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL);
+    esp_zb_cluster_add_attr(attr_list, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL, POLL_ATTR_CHECKIN_INTERVAL,
+                            ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE,
+                            &(uint32_t){CONFIG_ZB_CHECKIN_INTERVAL_S * 4U});
+    esp_zb_cluster_add_attr(attr_list, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL, POLL_ATTR_LONG_POLL_INTERVAL,
+                            ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &long_poll_qs);
+    esp_zb_cluster_add_attr(attr_list, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL, POLL_ATTR_SHORT_POLL_INTERVAL,
+                            ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &short_poll_qs);
+    esp_zb_cluster_add_attr(attr_list, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL, POLL_ATTR_FAST_POLL_TIMEOUT,
+                            ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE,
+                            &(uint16_t){CONFIG_ZB_FAST_POLL_TIMEOUT_MS / 250});
+    esp_zb_cluster_list_add_custom_cluster(cluster_list, attr_list, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
+    poll_endpoint = endpoint;
+#else
+    (void)cluster_list;
+    (void)endpoint;
+#endif
+}
+
+void zb_rx_mode_init(void)
+{
+#if CONFIG_ZB_RX_MODE_SLEEPY
+    esp_zb_set_rx_on_when_idle(false);
+    ESP_LOGI(TAG, "Sleepy end device: long poll %u ms, fast poll %u ms for %u ms after activity, check-in %u s",
+             (unsigned)QS_TO_MS(long_poll_qs), (unsigned)QS_TO_MS(short_poll_qs),
+             CONFIG_ZB_FAST_POLL_TIMEOUT_MS, CONFIG_ZB_CHECKIN_INTERVAL_S);
+#elif CONFIG_ZB_ZCZR
+    ESP_LOGI(TAG, "Router: receiver always on, up to %d children, network size %d",
+             CONFIG_ZB_ROUTER_MAX_CHILDREN, CONFIG_ZB_NETWORK_SIZE);
+#else
+    esp_zb_set_rx_on_when_idle(true);
+    ESP_LOGI(TAG, "Mains-powered bridge: receiver always on");
+#endif
+}
+
+void zb_rx_mode_joined(void)
+{
+    if (joined) {
+        return;
+    }
+    joined = true;
+#if CONFIG_ZB_RX_MODE_SLEEPY
+    // Интервал опроса сбрасывается стеком при подключении - задаем заново.
+    // Сразу после подключения хаб опрашивает устройство: начинаем с частого опроса.
+    fast_polling = false;
+    zb_zdo_pim_set_long_poll_interval(QS_TO_MS(long_poll_qs));
+    fast_poll_start(poll_attr_get(POLL_ATTR_FAST_POLL_TIMEOUT, CONFIG_ZB_FAST_POLL_TIMEOUT_MS / 250));
+    esp_zb_scheduler_alarm(checkin_send, 0, CONFIG_ZB_CHECKIN_INTERVAL_S ? CONFIG_ZB_CHECKIN_INTERVAL_S * 1000U : 1000);
+#endif
+#if CONFIG_ZB_LATENCY_LOG_S
+    static bool latency_started;
+    if (!latency_started) {
+        latency_started = true;
+        esp_zb_scheduler_alarm(latency_log, 0, CONFIG_ZB_LATENCY_LOG_S * 1000U);
+    }
+#endif
+}
+
+void zb_rx_mode_left(void)
+{
+    joined = false;
+#if CONFIG_ZB_RX_MODE_SLEEPY
+    esp_zb_scheduler_alarm_cancel(checkin_send, 0);
+    esp_zb_scheduler_alarm_cancel(fast_poll_end, 0);
+    fast_polling = false;
+#endif
+}
+
+void zb_rx_mode_activity(void)
+{
+#if CONFIG_ZB_RX_MODE_SLEEPY
+    fast_poll_start(poll_attr_get(POLL_ATTR_FAST_POLL_TIMEOUT, CONFIG_ZB_FAST_POLL_TIMEOUT_MS / 250));
+#endif
+}
+
+bool zb_rx_mode_handle_command(uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len,
+                               uint8_t *status)
+{
+#if CONFIG_ZB_RX_MODE_SLEEPY
+    if (endpoint != poll_endpoint) {
+        return false;
+    }
+    switch (cmd_id) {
+    case POLL_CMD_CHECK_IN_RESPONSE:
+        // [начать частый опрос][таймаут, 0 - Fast Poll Timeout]
+        if (len < 3) {
+            return false;
+        }
+        if (payload[0]) {
+            uint16_t timeout = payload[1] | (payload[2] << 8);
+            fast_poll_start(timeout ? timeout : poll_attr_get(POLL_ATTR_FAST_POLL_TIMEOUT, 0));
+        } else {
+            fast_poll_stop();
+        }
+        return true;
+
+    case POLL_CMD_FAST_POLL_STOP:
+        fast_poll_stop();
+        return true;
+
+    case POLL_CMD_SET_LONG_POLL: {
+        uint32_t interval = len >= 4 ? payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24) : 0;
+        if (interval < POLL_LONG_MIN_QS || interval < short_poll_qs) {
+            *status = ZB_ZCL_STATUS_INVALID_VALUE;
+            return true;
+        }
+        long_poll_qs = interval;
+        esp_zb_zcl_set_attribute_val(poll_endpoint, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                     POLL_ATTR_LONG_POLL_INTERVAL, &long_poll_qs, false);
+        if (!fast_polling && joined) {
+            zb_zdo_pim_set_long_poll_interval(QS_TO_MS(long_poll_qs));
+        }
+        return true;
+    }
+
+    case POLL_CMD_SET_SHORT_POLL: {
+        uint16_t interval = len >= 2 ? payload[0] | (payload[1] << 8) : 0;
+        if (interval == 0 || interval > long_poll_qs) {
+            *status = ZB_ZCL_STATUS_INVALID_VALUE;
+            return true;
+        }
+        short_poll_qs = interval;
+        esp_zb_zcl_set_attribute_val(poll_endpoint, ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                     POLL_ATTR_SHORT_POLL_INTERVAL, &short_poll_qs, false);
+        if (fast_polling) {
+            zb_zdo_pim_set_long_poll_interval(QS_TO_MS(short_poll_qs));
+        }
+        return true;
+    }
+
+    default:
+        return false;
+    }
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,37 @@
+// zb_rx_mode.h
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_zigbee_core.h"
+
+// Режим приема end device (menuconfig -> "Zigbee device"):
+// - мост с питанием от сети: приемник включен всегда (rx-on-when-idle),
+//   родитель передает команды сразу;
+// - sleepy: приемник включается только на опросы родителя, команда хаба
+//   ждет у родителя следующего опроса. После любой команды устройство
+//   какое-то время опрашивает часто (fast poll), в покое - с длинным
+//   интервалом. Кластер Poll Control на первом эндпоинте дает хабу check-in
+//   и управление интервалами.
+// В сборке роутера приемник включен всегда, режим не выбирается.
+// В обоих режимах в лог периодически выводится задержка команд до реле.
+// Все функции вызываются из задачи Zigbee.
+
+// Кластеры режима для первого эндпоинта (Poll Control в режиме sleepy)
+void zb_rx_mode_add_clusters(esp_zb_cluster_list_t *cluster_list, uint8_t endpoint);
+
+// Режим приемника, до esp_zb_start()
+void zb_rx_mode_init(void);
+
+// Устройство в сети (подключение или перезагрузка) / вышло из сети
+void zb_rx_mode_joined(void);
+void zb_rx_mode_left(void);
+
+// Принята команда от хаба: окно частого опроса
+void zb_rx_mode_activity(void);
+
+// Команда кластера Poll Control. false - команда не разобрана, иначе
+// *status - статус Default Response (недопустимый интервал - INVALID_VALUE)
+bool zb_rx_mode_handle_command(uint8_t endpoint, uint8_t cmd_id, const uint8_t *payload, size_t len,
+                               uint8_t *status);